@@ -88,6 +88,10 @@ project "Tiny16-Emulator"
             "implicit-fallthrough", 
         }
 
+    filter "system:linux"
+        links "pthread" -- host threads for multi-core execution
+        links "rt"      -- shm_open for the metrics segment on glibc before 2.34
+
     filter { "configurations:Debug" }
         kind "ConsoleApp"
         floatingpoint "Default"
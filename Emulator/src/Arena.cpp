@@ -0,0 +1,106 @@
+#include <new>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+#include <algorithm>
+
+#include "Log.hpp"
+#include "Arena.hpp"
+#include "Result.hpp"
+
+#ifdef PLATFORM_UNIX
+    #include <sys/mman.h>
+#endif
+
+#ifdef PLATFORM_UNIX
+static constexpr std::size_t HugePageSize = 2 * 1024 * 1024;
+static constexpr std::size_t PageSize = 4096;
+
+
+Result<void> PageRegion::Map(std::size_t size)
+{
+    // Reserved huge pages are never swapped or split, MAP_POPULATE faults them in right away
+    if (size >= HugePageSize)
+    {
+        m_Size = (size + HugePageSize - 1) / HugePageSize * HugePageSize;
+        m_Memory = mmap(nullptr, m_Size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+        if (m_Memory != MAP_FAILED)
+            return Ok();
+    }
+
+    // No huge pages reserved, fall back to transparent huge pages. Populating has to wait until
+    // after madvise, pages faulted in before it are regular 4 KiB pages.
+    m_Size = size == 0 ? 1 : size;
+    m_Memory = mmap(nullptr, m_Size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m_Memory == MAP_FAILED)
+    {
+        LOG_REASON("Failed to map {} bytes for an arena", m_Size);
+        m_Memory = nullptr;
+        m_Size = 0;
+        return Err();
+    }
+    if (m_Size >= HugePageSize)
+        madvise(m_Memory, m_Size, MADV_HUGEPAGE);
+
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(m_Memory, m_Size, MADV_POPULATE_WRITE) == 0)
+        return Ok();
+#endif
+    // Kernels before 5.14, one write per page faults it in
+    for (std::size_t offset = 0; offset < m_Size; offset += PageSize)
+        static_cast<volatile std::uint8_t*>(m_Memory)[offset] = 0;
+    return Ok();
+}
+
+
+PageRegion::~PageRegion()
+{
+    if (m_Memory != nullptr)
+        munmap(m_Memory, m_Size);
+}
+#else
+Result<void> PageRegion::Map(std::size_t size)
+{
+    m_Size = size == 0 ? 1 : size;
+    m_Memory = ::operator new(m_Size, std::align_val_t(64), std::nothrow);
+    if (m_Memory == nullptr)
+    {
+        LOG("Failed to allocate {} bytes for an arena", m_Size);
+        m_Size = 0;
+        return Err();
+    }
+    return Ok();
+}
+
+
+PageRegion::~PageRegion()
+{
+    if (m_Memory != nullptr)
+        ::operator delete(m_Memory, std::align_val_t(64));
+}
+#endif
+
+
+std::uint8_t* ByteArena::Allocate(std::size_t size)
+{
+    size = (size + Alignment - 1) / Alignment * Alignment;
+    for (; m_Current < m_Chunks.size(); ++m_Current, m_Offset = 0)
+    {
+        PageRegion& chunk = *m_Chunks[m_Current];
+        if (m_Offset + size <= chunk.GetSize())
+        {
+            std::uint8_t* const memory = static_cast<std::uint8_t*>(chunk.GetMemory()) + m_Offset;
+            m_Offset += size;
+            return memory;
+        }
+    }
+
+    std::unique_ptr<PageRegion> chunk = std::make_unique<PageRegion>();
+    if (chunk->Map(std::max(size, m_ChunkSize)).IsErr())
+        return nullptr;
+    m_Chunks.push_back(std::move(chunk));
+    m_Current = m_Chunks.size() - 1;
+    m_Offset = size;
+    return static_cast<std::uint8_t*>(m_Chunks.back()->GetMemory());
+}
@@ -0,0 +1,113 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+#include <new>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+
+#include "Result.hpp"
+
+// One large, cache line aligned block of memory. On Unix it is mapped with huge pages if
+// possible (MAP_HUGETLB, otherwise transparent huge pages) and faulted in up front, so
+// using it never page faults. Under the default first touch policy the pages end up on
+// the NUMA node of the thread that called Map.
+class PageRegion
+{
+private:
+    void* m_Memory = nullptr;
+    std::size_t m_Size = 0;
+public:
+    PageRegion() noexcept = default;
+    ~PageRegion();
+    PageRegion(const PageRegion&) = delete;
+    PageRegion& operator=(const PageRegion&) = delete;
+
+    // Maps size bytes, only valid on an empty region
+    Result<void> Map(std::size_t size);
+
+    inline void* GetMemory() const noexcept { return m_Memory; }
+    inline std::size_t GetSize() const noexcept { return m_Size; }
+};
+
+
+// Bump allocator for variable sized buffers, grows by whole PageRegions.
+// Reset hands all memory out again without returning it to the system.
+class ByteArena
+{
+private:
+    static constexpr std::size_t Alignment = 64;
+
+    std::vector<std::unique_ptr<PageRegion>> m_Chunks;
+    std::size_t m_ChunkSize;
+    std::size_t m_Current = 0;
+    std::size_t m_Offset = 0;
+public:
+    explicit ByteArena(std::size_t chunkSize = 2 * 1024 * 1024) noexcept : m_ChunkSize(chunkSize) {}
+
+    // Returns nullptr if no memory could be mapped
+    std::uint8_t* Allocate(std::size_t size);
+    inline void Reset() noexcept { m_Current = m_Offset = 0; }
+};
+
+
+// Fixed capacity pool of guest instances carved out of a single PageRegion.
+// Acquire and Release are O(1) and never allocate, neither of them is thread safe.
+template <typename T>
+class InstanceArena
+{
+private:
+    static constexpr std::size_t CacheLine = 64;
+
+    union Slot
+    {
+        Slot* next;
+        alignas(CacheLine) std::byte storage[(sizeof(T) + CacheLine - 1) / CacheLine * CacheLine];
+    };
+
+    std::size_t m_Capacity = 0;
+    std::size_t m_Used = 0; // slots handed out at least once
+    Slot* m_FreeList = nullptr;
+    PageRegion m_Region;
+public:
+    InstanceArena() noexcept = default;
+    ~InstanceArena() = default; // instances have to be released by their owners
+    InstanceArena(const InstanceArena&) = delete;
+    InstanceArena& operator=(const InstanceArena&) = delete;
+
+    // Maps the memory for capacity instances, has to succeed before the first Acquire
+    Result<void> Reserve(std::size_t capacity)
+    {
+        if (m_Region.Map(capacity * sizeof(Slot)).IsErr())
+            return Err();
+        m_Capacity = capacity;
+        return Ok();
+    }
+
+    // Returns nullptr if the arena is full or wasn't reserved
+    template <typename... Args>
+    T* Acquire(Args&&... args)
+    {
+        Slot* slot = m_FreeList;
+        if (slot != nullptr)
+            m_FreeList = slot->next;
+        else if (m_Used < m_Capacity)
+            slot = static_cast<Slot*>(m_Region.GetMemory()) + m_Used++;
+        else
+            return nullptr;
+        return ::new (static_cast<void*>(slot->storage)) T(std::forward<Args>(args)...);
+    }
+
+    void Release(T* instance) noexcept
+    {
+        instance->~T();
+        Slot* slot = reinterpret_cast<Slot*>(instance);
+        slot->next = m_FreeList;
+        m_FreeList = slot;
+    }
+
+    inline std::size_t Capacity() const noexcept { return m_Capacity; }
+};
+
+#endif // ARENA_HPP
@@ -0,0 +1,46 @@
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+#include "CPU.hpp"
+#include "Cycles.hpp"
+#include "Assembler.hpp"
+
+// Compile time checks of the encoding and of the instruction semantics, a failing check breaks the build
+
+template <std::size_t N>
+static consteval CPU Run(const std::array<std::uint8_t, N>& code)
+{
+    CPU cpu;
+    if (!cpu.Evaluate(code, Cycles::Default()))
+        Assembler::Impl::Error("Malformed binary");
+    return cpu;
+}
+
+
+// Encoding
+static_assert(Assembler::Assemble<"mov 1 r0 add 2 r0 sub 3 r0">() == std::array<std::uint8_t, 12>{ 20, 1, 0, 0, 30, 2, 0, 0, 32, 3, 0, 0 });
+static_assert(Assembler::Assemble<"MOV 0x1234, R8 ; comment\n mov rb r2 exit">() == std::array<std::uint8_t, 8>{ 20, 0x34, 0x12, 8, 21, 10, 2, 0xFF });
+static_assert(Assembler::Assemble<"imul -1 r3 idiv r1 r0 ext">() == std::array<std::uint8_t, 8>{ 36, 0xFF, 0xFF, 3, 41, 1, 0, 0xFF });
+static_assert(Assembler::Assemble<"">().empty());
+
+// Arithmetic wraps at 16 bit
+static_assert(Run(Assembler::Assemble<"mov 1 r0 add 2 r0 sub 3 r0 exit">()).GetRegister(CPU::Register::R0) == 0);
+static_assert(Run(Assembler::Assemble<"mov 0xFFFF r2 add 2 r2">()).GetRegister(CPU::Register::R2) == 1);
+static_assert(Run(Assembler::Assemble<"mov 0 r2 sub 1 r2">()).GetRegister(CPU::Register::R2) == 0xFFFF);
+static_assert(Run(Assembler::Assemble<"mov 300 r3 mul 300 r3">()).GetRegister(CPU::Register::R3) == static_cast<std::uint16_t>(300 * 300));
+static_assert(Run(Assembler::Assemble<"mov -3 r3 imul 5 r3">()).GetRegister(CPU::Register::R3) == static_cast<std::uint16_t>(-15));
+static_assert(Run(Assembler::Assemble<"mov 7 r4 mov r4 r5 add r5 r4">()).GetRegister(CPU::Register::R4) == 14);
+
+// Division writes the quotient to R0 and the remainder to R1, division by zero is ignored
+static_assert(Run(Assembler::Assemble<"mov 17 r2 div 5 r2">()).GetRegister(CPU::Register::R0) == 3);
+static_assert(Run(Assembler::Assemble<"mov 17 r2 div 5 r2">()).GetRegister(CPU::Register::R1) == 2);
+static_assert(Run(Assembler::Assemble<"mov 9 r0 mov 17 r2 div 0 r2">()).GetRegister(CPU::Register::R0) == 9);
+static_assert(Run(Assembler::Assemble<"mov -17 r2 mov 5 r3 idiv r3 r2">()).GetRegister(CPU::Register::R0) == static_cast<std::uint16_t>(-3));
+static_assert(Run(Assembler::Assemble<"mov -17 r2 mov 5 r3 idiv r3 r2">()).GetRegister(CPU::Register::R1) == static_cast<std::uint16_t>(-2));
+// IDIVI scales the register by the immediate first
+static_assert(Run(Assembler::Assemble<"mov 6 r2 idiv 4 r2">()).GetRegister(CPU::Register::R0) == 6);
+
+// Nothing after EXIT is executed and EXIT is charged like every other instruction
+static_assert(Run(Assembler::Assemble<"mov 1 r0 exit mov 2 r0">()).GetRegister(CPU::Register::R0) == 1);
+static_assert(Run(Assembler::Assemble<"mov 1 r0 mul 2 r0 div 1 r0 idiv r1 r0 exit">()).GetCycles() == 1 + 3 + 12 + 14 + 1);
@@ -0,0 +1,205 @@
+#ifndef ASSEMBLER_HPP
+#define ASSEMBLER_HPP
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+#include <optional>
+#include <algorithm>
+#include <string_view>
+
+#include "CPU.hpp"
+
+// Assembles the mnemonics from SPEC.txt at compile time, e.g.
+//     constexpr auto code = Assembler::Assemble<"mov 1 r0 add 2 r0 exit">();
+// Instructions and operands are separated by whitespace or commas, ; starts a comment until the end of the line.
+// The source operand decides between the immediate and the register form, immediates are decimal,
+// hexadecimal (0x) or negative. Errors fail the compilation.
+// The result can be run at compile time with CPU::Evaluate or decoded with Decode(std::span).
+namespace Assembler
+{
+    template <std::size_t N>
+    struct Source
+    {
+        char text[N];
+
+        consteval Source(const char (&str)[N]) noexcept { std::copy_n(str, N, text); }
+        constexpr std::string_view View() const noexcept { return { text, N - 1 }; }
+    };
+
+
+    namespace Impl
+    {
+        // Not constexpr, reaching it during constant evaluation makes the compiler report the message
+        inline void Error(const char*) noexcept {}
+
+
+        constexpr bool IsSeparator(char c) noexcept
+        {
+            return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == ',';
+        }
+
+
+        constexpr char Lower(char c) noexcept
+        {
+            return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+        }
+
+
+        constexpr bool Equals(std::string_view token, std::string_view lower) noexcept
+        {
+            if (token.size() != lower.size())
+                return false;
+            for (std::size_t i = 0; i < token.size(); ++i)
+            {
+                if (Lower(token[i]) != lower[i])
+                    return false;
+            }
+            return true;
+        }
+
+
+        constexpr std::optional<CPU::Register> ParseRegister(std::string_view token) noexcept
+        {
+            constexpr std::array<std::string_view, CPU::Register::RF> names = { "r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7", "r8", "rs", "rb" };
+            for (std::size_t i = 0; i < names.size(); ++i)
+            {
+                if (Equals(token, names[i]))
+                    return static_cast<CPU::Register>(i);
+            }
+            return std::nullopt;
+        }
+
+
+        constexpr std::optional<std::uint16_t> ParseImmediate(std::string_view token) noexcept
+        {
+            const bool negative = !token.empty() && token.front() == '-';
+            if (negative)
+                token.remove_prefix(1);
+
+            std::uint32_t base = 10;
+            if (token.size() > 2 && token[0] == '0' && Lower(token[1]) == 'x')
+            {
+                base = 16;
+                token.remove_prefix(2);
+            }
+            if (token.empty())
+                return std::nullopt;
+
+            std::uint32_t value = 0;
+            for (const char c : token)
+            {
+                std::uint32_t digit = base;
+                if (c >= '0' && c <= '9')
+                    digit = static_cast<std::uint32_t>(c - '0');
+                else if (Lower(c) >= 'a' && Lower(c) <= 'f')
+                    digit = static_cast<std::uint32_t>(Lower(c) - 'a' + 10);
+                if (digit >= base)
+                    return std::nullopt;
+
+                value = value * base + digit;
+                if (value > (negative ? 0x8000u : 0xFFFFu))
+                    return std::nullopt;
+            }
+            return static_cast<std::uint16_t>(negative ? 0x10000u - value : value);
+        }
+
+
+        class Lexer
+        {
+        private:
+            std::string_view m_Source;
+        public:
+            constexpr explicit Lexer(std::string_view source) noexcept : m_Source(source) {}
+
+            // Returns an empty token at the end of the source
+            constexpr std::string_view Next() noexcept
+            {
+                while (!m_Source.empty() && (IsSeparator(m_Source.front()) || m_Source.front() == ';'))
+                {
+                    if (m_Source.front() == ';')
+                    {
+                        const std::size_t end = m_Source.find('\n');
+                        m_Source.remove_prefix(end == std::string_view::npos ? m_Source.size() : end);
+                    }
+                    else
+                        m_Source.remove_prefix(1);
+                }
+
+                std::size_t size = 0;
+                while (size < m_Source.size() && !IsSeparator(m_Source[size]) && m_Source[size] != ';')
+                    ++size;
+                const std::string_view token = m_Source.substr(0, size);
+                m_Source.remove_prefix(size);
+                return token;
+            }
+        };
+
+
+        // Writes the binary to out if it isn't nullptr, returns its size in bytes
+        constexpr std::size_t Emit(std::string_view source, std::uint8_t* out)
+        {
+            constexpr std::array<std::pair<std::string_view, CPU::Instruction>, 7> mnemonics = { {
+                { "mov", CPU::Instruction::MOVI }, { "add", CPU::Instruction::ADDI }, { "sub", CPU::Instruction::SUBI },
+                { "mul", CPU::Instruction::MULI }, { "imul", CPU::Instruction::IMULI }, { "div", CPU::Instruction::DIVI },
+                { "idiv", CPU::Instruction::IDIVI }
+            } };
+
+            std::size_t size = 0;
+            const auto put = [&size, out](std::uint8_t byte) { if (out != nullptr) out[size] = byte; ++size; };
+
+            Lexer lexer(source);
+            for (std::string_view token = lexer.Next(); !token.empty(); token = lexer.Next())
+            {
+                if (Equals(token, "exit") || Equals(token, "ext"))
+                {
+                    put(static_cast<std::uint8_t>(CPU::Instruction::EXIT));
+                    continue;
+                }
+
+                std::optional<CPU::Instruction> instruction;
+                for (const auto& [name, immediate] : mnemonics)
+                {
+                    if (Equals(token, name))
+                        instruction = immediate;
+                }
+                if (!instruction.has_value())
+                    Error("Unknown mnemonic");
+
+                const std::string_view src = lexer.Next();
+                const std::optional<CPU::Register> dest = ParseRegister(lexer.Next());
+                if (!dest.has_value())
+                    Error("Destination has to be a register R0 - RB");
+
+                if (const std::optional<CPU::Register> reg = ParseRegister(src); reg.has_value())
+                {
+                    // the register form always follows the immediate form
+                    put(static_cast<std::uint8_t>(static_cast<std::size_t>(*instruction) + 1));
+                    put(static_cast<std::uint8_t>(*reg));
+                    put(static_cast<std::uint8_t>(*dest));
+                }
+                else if (const std::optional<std::uint16_t> imm = ParseImmediate(src); imm.has_value())
+                {
+                    put(static_cast<std::uint8_t>(*instruction));
+                    put(static_cast<std::uint8_t>(*imm & 0xFF));
+                    put(static_cast<std::uint8_t>(*imm >> 8));
+                    put(static_cast<std::uint8_t>(*dest));
+                }
+                else
+                    Error("Source has to be a 16 bit immediate or a register R0 - RB");
+            }
+            return size;
+        }
+    }
+
+
+    template <Source S>
+    consteval std::array<std::uint8_t, Impl::Emit(S.View(), nullptr)> Assemble()
+    {
+        std::array<std::uint8_t, Impl::Emit(S.View(), nullptr)> code = {};
+        Impl::Emit(S.View(), code.data());
+        return code;
+    }
+}
+
+#endif // ASSEMBLER_HPP
@@ -0,0 +1,168 @@
+#include <span>
+#include <array>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <optional>
+#include <filesystem>
+#include <string_view>
+
+#include "CPU.hpp"
+#include "Log.hpp"
+#include "Cache.hpp"
+#include "Image.hpp"
+#include "Result.hpp"
+#include "Decoder.hpp"
+#include "Metrics.hpp"
+#include "Handlers.hpp"
+#include "Benchmark.hpp"
+#include "PerfCounters.hpp"
+
+struct Measurement
+{
+    double seconds = 0;
+    std::uint64_t instructions = 0; // per run, BLOCK operations aren't instructions
+    std::uint64_t cycles = 0;       // per run
+    std::array<std::optional<std::uint64_t>, PerfCounters::Event::Count> host; // whole measurement
+};
+
+
+// Keeps the runs from being optimized away
+static volatile std::uint16_t Sink = 0;
+
+
+// handlers is empty for switch dispatch
+static Measurement Measure(const Program& program, std::span<const Handler> handlers, std::size_t iterations, PerfCounters& counters)
+{
+    Measurement measurement;
+    for (std::size_t i = 0; i < program.ops.size(); ++i)
+    {
+        if (program.ops[i].instruction != CPU::Instruction::BLOCK)
+            ++measurement.instructions;
+        if (program.ops[i].instruction == CPU::Instruction::EXIT)
+            break;
+    }
+
+    std::uint16_t sink = 0;
+    counters.Start();
+    const auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        CPU cpu;
+        if (handlers.empty())
+            cpu.Execute(program);
+        else
+            cpu.Execute(program, handlers);
+        sink = static_cast<std::uint16_t>(sink + cpu.GetRegister(CPU::Register::R0));
+        measurement.cycles = cpu.GetCycles();
+    }
+    measurement.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    counters.Stop();
+
+    for (std::size_t i = 0; i < PerfCounters::Event::Count; ++i)
+        measurement.host[i] = counters.Read(static_cast<PerfCounters::Event>(i));
+
+    Sink = sink;
+    return measurement;
+}
+
+
+static double NanosecondsPerInstruction(const Measurement& measurement, std::size_t iterations) noexcept
+{
+    const double instructions = static_cast<double>(measurement.instructions) * static_cast<double>(iterations);
+    return instructions == 0 ? 0 : measurement.seconds * 1e9 / instructions;
+}
+
+
+void RunBenchmark(const Program& program, std::size_t iterations)
+{
+    // Only the handler variants need the tables, the operations themselves don't carry handlers
+    const std::vector<Handler> specialized = Handlers::Bind(program);
+    const std::vector<Handler> generic = Handlers::Bind(program, false);
+
+    struct Variant
+    {
+        std::string_view name;
+        std::span<const Handler> handlers;
+        Measurement measurement = {};
+    };
+    std::array<Variant, 3> variants = { {
+        { "switch", {} },
+        { "specialized handlers", specialized },
+        { "generic handlers", generic }
+    } };
+
+    // The runs would swamp the counters of real guest programs
+    const Metrics::Suspend suspend;
+    PerfCounters counters;
+    for (Variant& variant : variants)
+        variant.measurement = Measure(program, variant.handlers, iterations, counters);
+
+    const Measurement& reference = variants[0].measurement;
+    LOG("Benchmark: {} runs, {} instructions and {} cycles per run, {} byte operations, {} handlers, {} byte tables", iterations, reference.instructions, reference.cycles, sizeof(Operation), Handlers::Count(), Handlers::TableSize());
+    const double referenceNs = NanosecondsPerInstruction(reference, iterations);
+    for (const Variant& variant : variants)
+    {
+        const double ns = NanosecondsPerInstruction(variant.measurement, iterations);
+        LOG("  {:<21} {:.3f} s, {:.3f} ns/instruction, {:.2f}x of switch{}", variant.name, variant.measurement.seconds, ns, ns == 0 ? 0 : referenceNs / ns, variant.handlers.empty() ? " (default)" : "");
+    }
+
+    const double instructions = static_cast<double>(reference.instructions) * static_cast<double>(iterations);
+    for (std::size_t i = 0; i < PerfCounters::Event::Count; ++i)
+    {
+        const PerfCounters::Event event = static_cast<PerfCounters::Event>(i);
+        const std::string_view name = PerfCounters::GetName(event);
+        for (const Variant& variant : variants)
+        {
+            const std::optional<std::uint64_t>& value = variant.measurement.host[i];
+            if (!value.has_value() || instructions == 0)
+                LOG("  {} per instruction, {}: {}", name, variant.name, counters.IsAvailable(event) ? "never scheduled" : "unavailable");
+            else
+                LOG("  {} per instruction, {}: {:.3f}", name, variant.name, static_cast<double>(*value) / instructions);
+        }
+    }
+}
+
+
+Result<void> RunCacheBenchmark(const Image& image, const std::filesystem::path& directory, std::size_t iterations)
+{
+    const Metrics::Suspend suspend;
+    const Cache cache(directory, Cache::DefaultCapacity, 0);
+    const Result<Program> program = Decode(image.code, image.entry);
+    if (program.IsErr())
+        return Err();
+
+    // Every run after the first finds the entry in the page cache
+    cache.Store(image, program.ForceUnwrap());
+    if (!cache.Load(image).has_value())
+    {
+        LOG("Cache benchmark: failed to store or load the entry in '{}'", directory.string());
+        return Err();
+    }
+
+    std::size_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < iterations; ++i)
+        sink += Decode(image.code, image.entry).ForceUnwrap().ops.size();
+    const double decodeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::size_t misses = 0;
+    start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        const std::optional<Program> cached = cache.Load(image);
+        if (cached.has_value())
+            sink += cached->ops.size();
+        else
+            ++misses;
+    }
+    const double hitSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    Sink = static_cast<std::uint16_t>(sink);
+
+    const double runs = static_cast<double>(iterations);
+    LOG("Cache benchmark: {} runs, {} bytes of code, {} operations", iterations, image.code.size(), program.ForceUnwrap().ops.size());
+    LOG("  decode     {:.3f} ms per run", decodeSeconds * 1e3 / runs);
+    LOG("  warm hit   {:.3f} ms per run, {:.2f}x of decode{}", hitSeconds * 1e3 / runs, hitSeconds == 0 ? 0 : decodeSeconds / hitSeconds, misses == 0 ? "" : " (some runs missed)");
+    return Ok();
+}
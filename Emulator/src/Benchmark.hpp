@@ -0,0 +1,18 @@
+#ifndef BENCHMARK_HPP
+#define BENCHMARK_HPP
+#include <cstddef>
+#include <filesystem>
+
+#include "Cache.hpp"
+#include "Image.hpp"
+#include "Result.hpp"
+#include "Decoder.hpp"
+
+// Executes the program iterations times, each on a fresh CPU, and logs the results
+void RunBenchmark(const Program& program, std::size_t iterations);
+
+// Decodes the image's code iterations times and loads it as often from a warm cache in directory, logs both.
+// Programs of any size are cached here, so the benchmark also covers the ones a Cache skips by default.
+Result<void> RunCacheBenchmark(const Image& image, const std::filesystem::path& directory, std::size_t iterations);
+
+#endif // BENCHMARK_HPP
@@ -1,9 +1,14 @@
-#include <vector>
+#include <array>
+#include <cctype>
 #include <cstdint>
+#include <cstddef>
+#include <optional>
+#include <string_view>
 
 #include "CPU.hpp"
 #include "Log.hpp"
-#include "Utility.hpp"
+#include "Decoder.hpp"
+#include "Metrics.hpp"
 
 #ifndef NDEBUG
 #include <iostream>
@@ -24,237 +29,113 @@ void CPU::Debug_PrintRegisters() const
     std::cout << "RS: " << std::setw(5) << m_Registers[Register::RS] << ' ' << std::setw(6) << (std::int16_t)m_Registers[Register::RS] << '\n';
     std::cout << "RB: " << std::setw(5) << m_Registers[Register::RB] << ' ' << std::setw(6) << (std::int16_t)m_Registers[Register::RB] << '\n';
     std::cout << "RF: " << std::setw(5) << m_Registers[Register::RF] << ' ' << std::setw(6) << (std::int16_t)m_Registers[Register::RF] << '\n';
+    std::cout << "\nCycles: " << m_Cycles << '\n';
     std::cout << std::endl;
 }
 #endif
 
 
-inline std::uint16_t CPU::GetImmediate16(const std::uint8_t* ptr) const noexcept
-{
-    uint16_t imm = *reinterpret_cast<const std::uint16_t*>(ptr);
-
-    // We emulate a little endian CPU
-    if constexpr (Util::Bytes::HostIsBigEndian())
-    {
-        return Util::Bytes::SwapEndian16(imm);
-    }
-    else
-    {
-        return imm;
-    }
-}
+static constexpr std::array<std::string_view, static_cast<std::size_t>(CPU::Register::RF) + 1> RegisterNames = {
+    "R0", "R1", "R2", "R3", "R4", "R5", "R6", "R7", "R8", "RS", "RB", "RF"
+};
 
 
-void CPU::Execute(const std::vector<std::uint8_t>& code) noexcept
+std::string_view CPU::GetRegisterName(Register reg) noexcept
 {
-    for (std::size_t i = 0; i < code.size();)
-    {
-        // TODO add flags e.g. overflow to add
-        switch (static_cast<Instruction>(code[i]))
-        {
-        case Instruction::MOVI: // mov (16bit) reg
-        {
-            ERR_IF(i + 4 > code.size(), "MOVI: Instruction not complete, expected {} bytes, received {} bytes, code index {}", 4, code.size() - i, i);
-
-            const std::uint16_t imm = GetImmediate16(&code[i + 1]);
-            const Register reg = static_cast<Register>(code[i + 3]);
-            ERR_IF(reg >= Register::RF, "MOVI: Illegal register used: 0x{:X}", static_cast<std::size_t>(reg));
-            m_Registers[reg] = imm;
-            i += 4;
-            break;
-        }
-        case Instruction::MOVR: // mov reg reg
-        {
-            ERR_IF(i + 3 > code.size(), "MOVR: Instruction not complete, expected {} bytes, received {} bytes, code index {}", 3, code.size() - i, i);
-
-            const std::uint8_t src = code[i + 1];
-            const std::uint8_t dest = code[i + 2];
-            ERR_IF(src >= Register::RF, "MOVR: Source register doesn't exist: 0x{:X}", src);
-            ERR_IF(dest >= Register::RF, "MOVR: Destination register doesn't exist: 0x{:X}", dest);
-            m_Registers[dest] = m_Registers[src];
-            i += 3;
-            break;
-        }
-        case Instruction::ADDI: // add (16bit) reg
-        {
-            ERR_IF(i + 4 > code.size(), "ADDI: Instruction not complete, expected {} bytes, received {} bytes, code index {}", 4, code.size() - i, i);
-
-            const std::uint16_t imm = GetImmediate16(&code[i + 1]);
-            const Register reg = static_cast<Register>(code[i + 3]);
-            ERR_IF(reg >= Register::RF, "ADDI: Illegal register used: 0x{:X}", static_cast<std::size_t>(reg));
-            m_Registers[reg] += imm;
-            i += 4;
-            break;
-        }
-        case Instruction::ADDR: // add reg reg
-        {
-            ERR_IF(i + 3 > code.size(), "ADDR: Instruction not complete, expected {} bytes, received {} bytes, code index {}", 3, code.size() - i, i);
+    return RegisterNames[reg];
+}
 
-            const std::uint8_t src = code[i + 1];
-            const std::uint8_t dest = code[i + 2];
-            ERR_IF(src >= Register::RF, "ADDR: Source register doesn't exist: 0x{:X}", src);
-            ERR_IF(dest >= Register::RF, "ADDR: Destination register doesn't exist: 0x{:X}", dest);
-            m_Registers[dest] += m_Registers[src];
-            i += 3;
-            break;
-        }
-        case Instruction::SUBI: // sub (16bit) reg
-        {
-            ERR_IF(i + 4 > code.size(), "SUBI: Instruction not complete, expected {} bytes, received {} bytes, code index {}", 4, code.size() - i, i);
 
-            const std::uint16_t imm = GetImmediate16(&code[i + 1]);
-            const Register reg = static_cast<Register>(code[i + 3]);
-            ERR_IF(reg >= Register::RF, "SUBI: Illegal register used: 0x{:X}", static_cast<std::size_t>(reg));
-            m_Registers[reg] -= imm;
-            i += 4;
-            break;
-        }
-        case Instruction::SUBR: // sub reg reg
-        {
-            ERR_IF(i + 3 > code.size(), "SUBR: Instruction not complete, expected {} bytes, received {} bytes, code index {}", 3, code.size() - i, i);
+std::optional<CPU::Register> CPU::ParseRegister(std::string_view name) noexcept
+{
+    if (name.size() != 2)
+        return std::nullopt;
 
-            const std::uint8_t src = code[i + 1];
-            const std::uint8_t dest = code[i + 2];
-            ERR_IF(src >= Register::RF, "SUBR: Source register doesn't exist: 0x{:X}", src);
-            ERR_IF(dest >= Register::RF, "SUBR: Destination register doesn't exist: 0x{:X}", dest);
-            m_Registers[dest] -= m_Registers[src];
-            i += 3;
-            break;
-        }
-        case Instruction::MULI: // mul (16bit) reg
-        {
-            ERR_IF(i + 4 > code.size(), "MULI: Instruction not complete, expected {} bytes, received {} bytes, code index {}", 4, code.size() - i, i);
+    const auto upper = [](char c) { return static_cast<char>(std::toupper(static_cast<unsigned char>(c))); };
+    for (std::size_t i = 0; i < RegisterNames.size(); ++i)
+    {
+        if (upper(name[0]) == RegisterNames[i][0] && upper(name[1]) == RegisterNames[i][1])
+            return static_cast<Register>(i);
+    }
+    return std::nullopt;
+}
 
-            const std::uint16_t imm = GetImmediate16(&code[i + 1]);
-            const Register reg = static_cast<Register>(code[i + 3]);
-            ERR_IF(reg >= Register::RF, "MULI: Illegal register used: 0x{:X}", static_cast<std::size_t>(reg));
-            m_Registers[reg] *= imm;
-            i += 4;
-            break;
-        }
-        case Instruction::MULR: // mul reg reg
-        {
-            ERR_IF(i + 3 > code.size(), "MULR: Instruction not complete, expected {} bytes, received {} bytes, code index {}", 3, code.size() - i, i);
 
-            const std::uint8_t src = code[i + 1];
-            const std::uint8_t dest = code[i + 2];
-            ERR_IF(src >= Register::RF, "MULR: Source register doesn't exist: 0x{:X}", src);
-            ERR_IF(dest >= Register::RF, "MULR: Destination register doesn't exist: 0x{:X}", dest);
-            m_Registers[dest] *= m_Registers[src];
-            i += 3;
-            break;
-        }
-        case Instruction::IMULI: // imul (16bit) reg
-        {
-            ERR_IF(i + 4 > code.size(), "IMULI: Instruction not complete, expected {} bytes, received {} bytes, code index {}", 4, code.size() - i, i);
+void CPU::Execute(const Program& program) noexcept
+{
+    Execute(program, 0, program.ops.size());
+}
 
-            const std::uint16_t imm = GetImmediate16(&code[i + 1]);
-            const Register reg = static_cast<Register>(code[i + 3]);
-            ERR_IF(reg >= Register::RF, "IMULI: Illegal register used: 0x{:X}", static_cast<std::size_t>(reg));
-            m_Registers[reg] = static_cast<std::int16_t>(m_Registers[reg]) * static_cast<std::int16_t>(imm);
-            i += 4;
-            break;
-        }
-        case Instruction::IMULR: // imul reg reg
-        {
-            ERR_IF(i + 3 > code.size(), "IMULR: Instruction not complete, expected {} bytes, received {} bytes, code index {}", 3, code.size() - i, i);
 
-            const std::uint8_t src = code[i + 1];
-            const std::uint8_t dest = code[i + 2];
-            ERR_IF(src >= Register::RF, "IMULR: Source register doesn't exist: 0x{:X}", src);
-            ERR_IF(dest >= Register::RF, "IMULR: Destination register doesn't exist: 0x{:X}", dest);
-            m_Registers[dest] = static_cast<std::int16_t>(m_Registers[dest]) * static_cast<std::int16_t>(m_Registers[src]);
-            i += 3;
-            break;
-        }
-        case Instruction::DIVI: // div (16bit) reg
-        {
-            ERR_IF(i + 4 > code.size(), "DIVI: Instruction not complete, expected {} bytes, received {} bytes, code index {}", 4, code.size() - i, i);
+std::size_t CPU::Execute(const Program& program, std::size_t begin, std::size_t end) noexcept
+{
+    const std::size_t pc = DispatchSwitch(program, begin, end);
 
-            const std::uint16_t imm = GetImmediate16(&code[i + 1]);
-            const Register reg = static_cast<Register>(code[i + 3]);
-            ERR_IF(reg >= Register::RF, "DIVI: Illegal register used: 0x{:X}", static_cast<std::size_t>(reg));
+    // Once per call, the loops stay untouched
+    Metrics::RecordExecution(program, begin, end, pc);
+    return pc;
+}
 
-            [[likely]] if (imm != 0)
-            {
-                // otherwise we may override R0 for the second division
-                const uint16_t r0tmp = m_Registers[reg] / imm;
-                const uint16_t r1tmp = m_Registers[reg] % imm;
-                m_Registers[Register::R0] = r0tmp;
-                m_Registers[Register::R1] = r1tmp;
-            }
-            i += 4;
-            break;
-        }
-        case Instruction::DIVR: // div reg reg
-        {
-            ERR_IF(i + 3 > code.size(), "DIVR: Instruction not complete, expected {} bytes, received {} bytes, code index {}", 3, code.size() - i, i);
 
-            const std::uint8_t src = code[i + 1];
-            const std::uint8_t dest = code[i + 2];
-            ERR_IF(src >= Register::RF, "DIVR: Source register doesn't exist: 0x{:X}", src);
-            ERR_IF(dest >= Register::RF, "DIVR: Destination register doesn't exist: 0x{:X}", dest);
+void CPU::Execute(const Program& program, std::span<const Handler> handlers) noexcept
+{
+    Execute(program, handlers, 0, program.ops.size());
+}
 
-            [[likely]] if (m_Registers[src] != 0)
-            {
-                // otherwise the my override R0 for the second division
-                const std::uint16_t r0tmp = m_Registers[dest] / m_Registers[src];
-                const std::uint16_t r1tmp = m_Registers[dest] % m_Registers[src];
-                m_Registers[Register::R0] = r0tmp;
-                m_Registers[Register::R1] = r1tmp;
-            }
-            i += 3;
-            break;
-        }
-        case Instruction::IDIVI: // idiv (16bit) reg
-        {
-            ERR_IF(i + 4 > code.size(), "IDIVI: Instruction not complete, expected {} bytes, received {} bytes, code index {}", 4, code.size() - i, i);
 
-            const std::uint16_t imm = GetImmediate16(&code[i + 1]);
-            const Register reg = static_cast<Register>(code[i + 3]);
-            ERR_IF(reg >= Register::RF, "IDIVI: Illegal register used: 0x{:X}", static_cast<std::size_t>(reg));
-            m_Registers[reg] = static_cast<std::int16_t>(m_Registers[reg]) * static_cast<std::int16_t>(imm);
+std::size_t CPU::Execute(const Program& program, std::span<const Handler> handlers, std::size_t begin, std::size_t end) noexcept
+{
+    const std::size_t pc = DispatchHandlers(program, handlers, begin, end);
+    Metrics::RecordExecution(program, begin, end, pc);
+    return pc;
+}
 
-            [[likely]] if (imm != 0)
-            {
-                // otherwise we may override R0 for the second division
-                const std::int16_t r0tmp = static_cast<std::int16_t>(m_Registers[reg]) / static_cast<std::int16_t>(imm);
-                const std::int16_t r1tmp = static_cast<std::int16_t>(m_Registers[reg]) % static_cast<std::int16_t>(imm);
-                m_Registers[Register::R0] = r0tmp;
-                m_Registers[Register::R1] = r1tmp;
-            }
 
-            i += 4;
-            break;
-        }
-        case Instruction::IDIVR: // idiv reg reg
+std::size_t CPU::DispatchSwitch(const Program& program, std::size_t begin, std::size_t end) noexcept
+{
+    for (std::size_t pc = begin; pc < end; ++pc)
+    {
+        const Operation& op = program.ops[pc];
+        switch (op.instruction)
         {
-            ERR_IF(i + 3 > code.size(), "IDIVR: Instruction not complete, expected {} bytes, received {} bytes, code index {}", 3, code.size() - i, i);
-
-            const std::uint8_t src = code[i + 1];
-            const std::uint8_t dest = code[i + 2];
-            ERR_IF(src >= Register::RF, "IDIVR: Source register doesn't exist: 0x{:X}", src);
-            ERR_IF(dest >= Register::RF, "IDIVR: Destination register doesn't exist: 0x{:X}", dest);
-
-            [[likely]] if (m_Registers[src] != 0)
-            {
-                // otherwise we may override R0 for the second division
-                const std::int16_t r0tmp = static_cast<std::int16_t>(m_Registers[dest]) / static_cast<std::int16_t>(m_Registers[src]);
-                const std::int16_t r1tmp = static_cast<std::int16_t>(m_Registers[dest]) % static_cast<std::int16_t>(m_Registers[src]);
-                m_Registers[Register::R0] = r0tmp;
-                m_Registers[Register::R1] = r1tmp;
-            }
-
-            i += 3;
+        case Instruction::BLOCK: // the whole block is charged up front
+            m_Cycles += op.imm;
             break;
-        }
+        case Instruction::MOVI:  Apply<Instruction::MOVI>(op.dest, op.imm);                 break;
+        case Instruction::MOVR:  Apply<Instruction::MOVR>(op.dest, m_Registers[op.src]);    break;
+        case Instruction::ADDI:  Apply<Instruction::ADDI>(op.dest, op.imm);                 break;
+        case Instruction::ADDR:  Apply<Instruction::ADDR>(op.dest, m_Registers[op.src]);    break;
+        case Instruction::SUBI:  Apply<Instruction::SUBI>(op.dest, op.imm);                 break;
+        case Instruction::SUBR:  Apply<Instruction::SUBR>(op.dest, m_Registers[op.src]);    break;
+        case Instruction::MULI:  Apply<Instruction::MULI>(op.dest, op.imm);                 break;
+        case Instruction::MULR:  Apply<Instruction::MULR>(op.dest, m_Registers[op.src]);    break;
+        case Instruction::IMULI: Apply<Instruction::IMULI>(op.dest, op.imm);                break;
+        case Instruction::IMULR: Apply<Instruction::IMULR>(op.dest, m_Registers[op.src]);   break;
+        case Instruction::DIVI:  Apply<Instruction::DIVI>(op.dest, op.imm);                 break;
+        case Instruction::DIVR:  Apply<Instruction::DIVR>(op.dest, m_Registers[op.src]);    break;
+        case Instruction::IDIVI: Apply<Instruction::IDIVI>(op.dest, op.imm);                break;
+        case Instruction::IDIVR: Apply<Instruction::IDIVR>(op.dest, m_Registers[op.src]);   break;
         case Instruction::EXIT:
-        {
-            return;
-        }
+        case Instruction::TRAP:
+            return pc;
         default:
-            ERR("Unsupported instruction used: 0x{:X} ({})", static_cast<std::size_t>(code[i]), static_cast<std::size_t>(code[i]));
+            ERR("Unsupported instruction used: 0x{:X} ({})", static_cast<std::size_t>(op.instruction), static_cast<std::size_t>(op.instruction));
             break;
         }
     }
-}
\ No newline at end of file
+    return end;
+}
+
+
+std::size_t CPU::DispatchHandlers(const Program& program, std::span<const Handler> handlers, std::size_t begin, std::size_t end) noexcept
+{
+    ERR_IF(handlers.size() != program.ops.size(), "Handler table doesn't match the program: {} handlers, {} operations", handlers.size(), program.ops.size());
+    for (std::size_t pc = begin; pc < end; ++pc)
+    {
+        const Operation& op = program.ops[pc];
+        ERR_IF(handlers[pc] == nullptr, "Operation without handler: 0x{:X} ({}), index {}", static_cast<std::size_t>(op.instruction), static_cast<std::size_t>(op.instruction), pc);
+        [[unlikely]] if (!handlers[pc](*this, op))
+            return pc;
+    }
+    return end;
+}
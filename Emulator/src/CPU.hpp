@@ -1,8 +1,11 @@
 #ifndef CPU_H
 #define CPU_H
+#include <span>
 #include <array>
-#include <vector>
 #include <cstdint>
+#include <cstddef>
+#include <optional>
+#include <string_view>
 
 #ifndef NDEBUG
 #define CPU_PRINT_REGISTERS(cpu) cpu.Debug_PrintRegisters()
@@ -10,6 +13,13 @@
 #define CPU_PRINT_REGISTERS(cpu)
 #endif
 
+class CPU;
+struct Program;
+struct Operation;
+
+// Executes a single operation, returns false if execution has to stop (EXIT or TRAP), see Handlers
+using Handler = bool (*)(CPU& cpu, const Operation& op) noexcept;
+
 class CPU
 {
 public:
@@ -29,7 +39,11 @@ public:
         DIVR  = 39,
         IDIVI = 40,
         IDIVR = 41,
-        EXIT = 0xFF
+        EXIT = 0xFF,
+
+        // Internal, only produced by the decoder and never encoded in a binary
+        BLOCK = 0x100, // start of a basic block, imm holds its summed cycle cost
+        TRAP  = 0x101  // patched in by the debugger over a breakpoint, stops execution
     };
 
     enum Register
@@ -49,15 +63,138 @@ public:
     };
 
 private:
+    friend class Handlers;
+
     std::array<std::uint16_t, static_cast<std::size_t>(Register::RF) + 1> m_Registers = { 0 };
-private:
-    inline std::uint16_t GetImmediate16(const std::uint8_t* ptr) const noexcept;
+    std::uint64_t m_Cycles = 0;
+
+    // Semantics of every instruction, shared by the handlers and Evaluate
+    template <Instruction I>
+    constexpr void Apply(std::size_t dest, std::uint16_t value) noexcept
+    {
+        // TODO add flags e.g. overflow to add
+        std::uint16_t& reg = m_Registers[dest];
+        if constexpr (I == Instruction::MOVI || I == Instruction::MOVR)
+        {
+            reg = value;
+        }
+        else if constexpr (I == Instruction::ADDI || I == Instruction::ADDR)
+        {
+            reg = static_cast<std::uint16_t>(reg + value);
+        }
+        else if constexpr (I == Instruction::SUBI || I == Instruction::SUBR)
+        {
+            reg = static_cast<std::uint16_t>(reg - value);
+        }
+        else if constexpr (I == Instruction::MULI || I == Instruction::MULR)
+        {
+            reg = static_cast<std::uint16_t>(static_cast<std::uint32_t>(reg) * value);
+        }
+        else if constexpr (I == Instruction::IMULI || I == Instruction::IMULR)
+        {
+            reg = static_cast<std::uint16_t>(static_cast<std::int16_t>(reg) * static_cast<std::int16_t>(value));
+        }
+        else if constexpr (I == Instruction::DIVI || I == Instruction::DIVR)
+        {
+            [[likely]] if (value != 0)
+            {
+                // otherwise we may override R0 for the second division
+                const std::uint16_t r0tmp = static_cast<std::uint16_t>(reg / value);
+                const std::uint16_t r1tmp = static_cast<std::uint16_t>(reg % value);
+                m_Registers[Register::R0] = r0tmp;
+                m_Registers[Register::R1] = r1tmp;
+            }
+        }
+        else if constexpr (I == Instruction::IDIVI || I == Instruction::IDIVR)
+        {
+            // IDIVI has always scaled the register by the immediate before dividing
+            if constexpr (I == Instruction::IDIVI)
+                reg = static_cast<std::uint16_t>(static_cast<std::int16_t>(reg) * static_cast<std::int16_t>(value));
+
+            [[likely]] if (value != 0)
+            {
+                // otherwise we may override R0 for the second division
+                const std::int16_t r0tmp = static_cast<std::int16_t>(static_cast<std::int16_t>(reg) / static_cast<std::int16_t>(value));
+                const std::int16_t r1tmp = static_cast<std::int16_t>(static_cast<std::int16_t>(reg) % static_cast<std::int16_t>(value));
+                m_Registers[Register::R0] = static_cast<std::uint16_t>(r0tmp);
+                m_Registers[Register::R1] = static_cast<std::uint16_t>(r1tmp);
+            }
+        }
+    }
+
+    std::size_t DispatchSwitch(const Program& program, std::size_t begin, std::size_t end) noexcept;
+    std::size_t DispatchHandlers(const Program& program, std::span<const Handler> handlers, std::size_t begin, std::size_t end) noexcept;
 public:
-    void Execute(const std::vector<std::uint8_t>& code) noexcept;
+    // Runs the operations [begin, end) and returns the index execution stopped at:
+    // the EXIT or TRAP operation that was hit, otherwise end
+    std::size_t Execute(const Program& program, std::size_t begin, std::size_t end) noexcept;
+    void Execute(const Program& program) noexcept;
+
+    // Same as above, but calls handlers[i] for operation i instead of switching over the instruction.
+    // The table comes from Handlers::Bind, --bench compares both and the switch is faster on current hosts.
+    std::size_t Execute(const Program& program, std::span<const Handler> handlers, std::size_t begin, std::size_t end) noexcept;
+    void Execute(const Program& program, std::span<const Handler> handlers) noexcept;
+
+    // Interprets a raw binary without decoding it first, so it can run in constant expressions.
+    // costs is indexed by opcode (Cycles::Default()), returns false if the binary is malformed.
+    constexpr bool Evaluate(std::span<const std::uint8_t> code, const std::array<std::uint8_t, 256>& costs, std::size_t entry = 0) noexcept;
+
+    inline constexpr std::uint64_t GetCycles() const noexcept { return m_Cycles; }
+
+    // Register names as in SPEC.txt, parsing ignores case
+    static std::string_view GetRegisterName(Register reg) noexcept;
+    static std::optional<Register> ParseRegister(std::string_view name) noexcept;
+
+    inline constexpr std::uint16_t GetRegister(Register reg) const noexcept { return m_Registers[reg]; }
+    inline constexpr void SetRegister(Register reg, std::uint16_t value) noexcept { m_Registers[reg] = value; }
 
     #ifndef NDEBUG
         void Debug_PrintRegisters() const;
     #endif
 };
 
+
+constexpr bool CPU::Evaluate(std::span<const std::uint8_t> code, const std::array<std::uint8_t, 256>& costs, std::size_t entry) noexcept
+{
+    std::size_t i = entry;
+    while (i < code.size())
+    {
+        const Instruction instruction = static_cast<Instruction>(code[i]);
+        m_Cycles += costs[code[i]];
+        if (instruction == Instruction::EXIT)
+            return true;
+
+        const bool immediate = code[i] % 2 == 0;
+        if (i + (immediate ? 4 : 3) > code.size())
+            return false;
+
+        const std::uint8_t dest = code[i + (immediate ? 3 : 2)];
+        if (dest >= Register::RF || (!immediate && code[i + 1] >= Register::RF))
+            return false;
+        const std::uint16_t value = immediate ? static_cast<std::uint16_t>(code[i + 1] | code[i + 2] << 8) : m_Registers[code[i + 1]];
+        i += immediate ? 4 : 3;
+
+        switch (instruction)
+        {
+        case Instruction::MOVI:  Apply<Instruction::MOVI>(dest, value);  break;
+        case Instruction::MOVR:  Apply<Instruction::MOVR>(dest, value);  break;
+        case Instruction::ADDI:  Apply<Instruction::ADDI>(dest, value);  break;
+        case Instruction::ADDR:  Apply<Instruction::ADDR>(dest, value);  break;
+        case Instruction::SUBI:  Apply<Instruction::SUBI>(dest, value);  break;
+        case Instruction::SUBR:  Apply<Instruction::SUBR>(dest, value);  break;
+        case Instruction::MULI:  Apply<Instruction::MULI>(dest, value);  break;
+        case Instruction::MULR:  Apply<Instruction::MULR>(dest, value);  break;
+        case Instruction::IMULI: Apply<Instruction::IMULI>(dest, value); break;
+        case Instruction::IMULR: Apply<Instruction::IMULR>(dest, value); break;
+        case Instruction::DIVI:  Apply<Instruction::DIVI>(dest, value);  break;
+        case Instruction::DIVR:  Apply<Instruction::DIVR>(dest, value);  break;
+        case Instruction::IDIVI: Apply<Instruction::IDIVI>(dest, value); break;
+        case Instruction::IDIVR: Apply<Instruction::IDIVR>(dest, value); break;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
 #endif // CPU_H
\ No newline at end of file
@@ -0,0 +1,160 @@
+#include <vector>
+#include <format>
+#include <chrono>
+#include <random>
+#include <string>
+#include <cstdint>
+#include <utility>
+#include <optional>
+#include <algorithm>
+#include <filesystem>
+#include <system_error>
+
+#include "Log.hpp"
+#include "File.hpp"
+#include "Cache.hpp"
+#include "Image.hpp"
+#include "Result.hpp"
+#include "Decoder.hpp"
+#include "Metrics.hpp"
+#include "Utility.hpp"
+
+static constexpr std::string_view EntryExtension = ".ty";
+static constexpr std::string_view TemporaryExtension = ".tmp";
+
+// Temporaries older than this were left behind by a writer that died before publishing them
+static constexpr std::chrono::minutes StaleTemporaryAge(5);
+
+
+Cache::Cache(std::filesystem::path directory, std::uintmax_t capacity, std::size_t minimumCodeSize)
+    : m_Directory(std::move(directory)), m_Capacity(capacity), m_MinimumCodeSize(minimumCodeSize)
+{
+    std::error_code ec;
+    std::filesystem::create_directories(m_Directory, ec);
+    LOG_IF(ec, "Failed to create cache directory '{}': {}", m_Directory.string(), ec.message());
+}
+
+
+std::filesystem::path Cache::EntryPath(const Image& image) const
+{
+    const std::uint64_t hash = Util::Hash::XXH64(image.code.data(), image.code.size(), image.entry);
+    return m_Directory / std::format("{:016x}-v{:08x}{}", hash, Version, EntryExtension);
+}
+
+
+std::optional<Program> Cache::Find(const Image& image) const
+{
+    const std::filesystem::path path = EntryPath(image);
+    std::error_code ec;
+    if (!std::filesystem::exists(path, ec))
+        return std::nullopt;
+
+    Result<Image> cached = LoadImage(path.string());
+    if (cached.IsErr())
+        return std::nullopt;
+
+    // The key already covers the code and the entry point, comparing the sizes is all that's left
+    Image entry = std::move(cached).ForceUnwrap();
+    if (!entry.program.has_value() || entry.entry != image.entry || entry.code.size() != image.code.size())
+        return std::nullopt;
+
+    // Refresh the modification time, eviction removes the least recently used entries first
+    std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+    return std::move(entry.program);
+}
+
+
+std::optional<Program> Cache::Load(const Image& image) const
+{
+    if (image.code.size() < m_MinimumCodeSize)
+        return std::nullopt;
+
+    std::optional<Program> program = Find(image);
+    Metrics::Add(program.has_value() ? &Metrics::Counters::decodeCacheHits : &Metrics::Counters::decodeCacheMisses, 1);
+    return program;
+}
+
+
+void Cache::Store(const Image& image, const Program& program) const
+{
+    if (image.code.size() < m_MinimumCodeSize)
+        return;
+
+    Image entry;
+    entry.entry = image.entry;
+    entry.code = image.code;
+    entry.program = program;
+
+    // Write to a unique temporary file first, the rename publishes it atomically
+    const std::filesystem::path path = EntryPath(image);
+    std::random_device random;
+    std::filesystem::path temporary = path;
+    temporary += std::format(".{:016x}{}", std::uniform_int_distribution<std::uint64_t>()(random), TemporaryExtension);
+
+    if (SaveFile(temporary.string(), SerializeImage(entry)).IsErr())
+        return;
+
+    std::error_code ec;
+    std::filesystem::rename(temporary, path, ec);
+    if (ec)
+    {
+        LOG("Failed to publish cache entry '{}': {}", path.string(), ec.message());
+        std::filesystem::remove(temporary, ec);
+        return;
+    }
+    Evict();
+}
+
+
+void Cache::Evict() const
+{
+    struct Entry
+    {
+        std::filesystem::path path;
+        std::uintmax_t size;
+        std::filesystem::file_time_type time;
+    };
+
+    std::error_code ec;
+    std::vector<Entry> entries;
+    std::uintmax_t total = 0;
+    const std::filesystem::file_time_type now = std::filesystem::file_time_type::clock::now();
+    for (const std::filesystem::directory_entry& file : std::filesystem::directory_iterator(m_Directory, ec))
+    {
+        const std::filesystem::path extension = file.path().extension();
+        if (extension != EntryExtension && extension != TemporaryExtension)
+            continue;
+
+        // Either can fail when another process removed the file in the meantime
+        std::error_code sizeError;
+        std::error_code timeError;
+        const std::uintmax_t size = file.file_size(sizeError);
+        const std::filesystem::file_time_type time = file.last_write_time(timeError);
+        if (sizeError || timeError)
+            continue;
+
+        // Temporaries still being written count against the capacity but are only removed once stale
+        if (extension == TemporaryExtension && now - time > StaleTemporaryAge)
+        {
+            std::filesystem::remove(file.path(), ec);
+            continue;
+        }
+        if (extension == EntryExtension)
+            entries.push_back({ file.path(), size, time });
+        total += size;
+    }
+
+    if (total <= m_Capacity)
+        return;
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.time < b.time; });
+    for (const Entry& entry : entries)
+    {
+        if (total <= m_Capacity)
+            break;
+
+        // Concurrent readers that already opened the file keep reading it, later ones see a miss
+        std::filesystem::remove(entry.path, ec);
+        total -= entry.size;
+    }
+}
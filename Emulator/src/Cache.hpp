@@ -0,0 +1,62 @@
+#ifndef CACHE_HPP
+#define CACHE_HPP
+#include <cstdint>
+#include <cstddef>
+#include <optional>
+#include <filesystem>
+
+#include "Image.hpp"
+#include "Cycles.hpp"
+#include "Decoder.hpp"
+
+// On-disk cache of decoded programs, stored as containers with a decoded section.
+// Entries are keyed by a hash of the code, the entry point and the cache version and are
+// published with an atomic rename, readers therefore only ever see complete files.
+// An entry found under the key is trusted to be for the code, a hit costs one load of the entry.
+// Failures are logged and treated as misses, the cache never fails a run.
+class Cache
+{
+public:
+    // Bump Revision whenever the decoder changes the decoded form without changing any of the on-disk
+    // format below, the cycle table, the block size and the container layout are folded in
+    static constexpr std::uint32_t Revision = 1;
+    static constexpr std::uint32_t Version = []
+    {
+        std::uint32_t hash = 2166136261u; // FNV-1a
+        const auto mix = [&hash](std::size_t value)
+        {
+            for (std::size_t i = 0; i < sizeof(std::uint32_t); ++i, value >>= 8)
+                hash = (hash ^ static_cast<std::uint8_t>(value)) * 16777619u;
+        };
+        mix(Revision);
+        mix(Image::Version);
+        mix(Image::HeaderSize);
+        mix(Image::OperationSize);
+        mix(Image::CountSize);
+        mix(Program::MaxBlockSize);
+        mix(static_cast<std::size_t>(CPU::Instruction::BLOCK));
+        mix(static_cast<std::size_t>(CPU::Instruction::TRAP));
+        for (const std::uint8_t cost : Cycles::Default())
+            mix(cost);
+        return hash;
+    }();
+    static constexpr std::uintmax_t DefaultCapacity = 64 * 1024 * 1024;
+
+    // Smaller programs decode faster than a warm hit loads them (--bench-cache), they bypass the cache
+    static constexpr std::size_t DefaultMinimumCodeSize = 16 * 1024;
+private:
+    std::filesystem::path m_Directory;
+    std::uintmax_t m_Capacity;
+    std::size_t m_MinimumCodeSize;
+private:
+    std::filesystem::path EntryPath(const Image& image) const;
+    std::optional<Program> Find(const Image& image) const;
+    void Evict() const;
+public:
+    explicit Cache(std::filesystem::path directory, std::uintmax_t capacity = DefaultCapacity, std::size_t minimumCodeSize = DefaultMinimumCodeSize);
+
+    std::optional<Program> Load(const Image& image) const;
+    void Store(const Image& image, const Program& program) const;
+};
+
+#endif // CACHE_HPP
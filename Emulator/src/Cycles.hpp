@@ -0,0 +1,37 @@
+#ifndef CYCLES_HPP
+#define CYCLES_HPP
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+#include "CPU.hpp"
+
+namespace Cycles
+{
+    // Cost of every instruction in cycles, indexed by opcode
+    using Table = std::array<std::uint8_t, 256>;
+
+    consteval Table Default() noexcept
+    {
+        Table table = { 0 };
+        const auto set = [&table](CPU::Instruction instruction, std::uint8_t cost) { table[static_cast<std::size_t>(instruction)] = cost; };
+        set(CPU::Instruction::MOVI,  1);
+        set(CPU::Instruction::MOVR,  1);
+        set(CPU::Instruction::ADDI,  1);
+        set(CPU::Instruction::ADDR,  1);
+        set(CPU::Instruction::SUBI,  1);
+        set(CPU::Instruction::SUBR,  1);
+        set(CPU::Instruction::MULI,  3);
+        set(CPU::Instruction::MULR,  3);
+        set(CPU::Instruction::IMULI, 3);
+        set(CPU::Instruction::IMULR, 3);
+        set(CPU::Instruction::DIVI,  12);
+        set(CPU::Instruction::DIVR,  12);
+        set(CPU::Instruction::IDIVI, 14);
+        set(CPU::Instruction::IDIVR, 14);
+        set(CPU::Instruction::EXIT,  1);
+        return table;
+    }
+}
+
+#endif // CYCLES_HPP
@@ -0,0 +1,217 @@
+#include <array>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <istream>
+#include <ostream>
+#include <charconv>
+#include <iomanip>
+#include <sstream>
+#include <optional>
+#include <string_view>
+
+#include "CPU.hpp"
+#include "Decoder.hpp"
+#include "Debugger.hpp"
+
+static std::optional<std::size_t> ParseAddress(std::string_view str) noexcept
+{
+    // One call per base, a base only known at runtime trips -Wstrict-overflow in the inlined from_chars
+    const bool hex = str.starts_with("0x") || str.starts_with("0X");
+    if (hex)
+        str.remove_prefix(2);
+
+    std::size_t address = 0;
+    const char* const last = str.data() + str.size();
+    if (str.empty() || (hex ? std::from_chars(str.data(), last, address, 16) : std::from_chars(str.data(), last, address)).ec != std::errc())
+        return std::nullopt;
+    return address;
+}
+
+
+Debugger::Debugger(CPU& cpu, const Program& program) : m_CPU(cpu), m_Original(program), m_Patched(program)
+{
+}
+
+
+std::size_t Debugger::FindOperation(std::size_t address) const noexcept
+{
+    for (std::size_t i = 0; i < m_Original.ops.size(); ++i)
+    {
+        if (m_Original.addresses[i] == address && m_Original.ops[i].instruction != CPU::Instruction::BLOCK)
+            return i;
+    }
+    return m_Original.ops.size();
+}
+
+
+void Debugger::EnterBlocks() noexcept
+{
+    // Blocks are charged when entered, just like the execute loop does it
+    while (m_PC < m_Original.ops.size() && m_Original.ops[m_PC].instruction == CPU::Instruction::BLOCK)
+    {
+        m_CPU.Execute(m_Original, m_PC, m_PC + 1);
+        ++m_PC;
+    }
+}
+
+
+bool Debugger::IsWatching() const noexcept
+{
+    for (const bool watched : m_Watched)
+    {
+        if (watched)
+            return true;
+    }
+    return false;
+}
+
+
+bool Debugger::SetBreakpoint(std::size_t address) noexcept
+{
+    const std::size_t index = FindOperation(address);
+    if (index == m_Original.ops.size())
+        return false;
+
+    m_Patched.ops[index].instruction = CPU::Instruction::TRAP;
+    return true;
+}
+
+
+bool Debugger::ClearBreakpoint(std::size_t address) noexcept
+{
+    const std::size_t index = FindOperation(address);
+    if (index == m_Original.ops.size() || m_Patched.ops[index].instruction != CPU::Instruction::TRAP)
+        return false;
+
+    m_Patched.ops[index] = m_Original.ops[index];
+    return true;
+}
+
+
+std::size_t Debugger::GetAddress() const noexcept
+{
+    if (HasExited())
+        return m_Original.addresses.empty() ? 0 : m_Original.addresses.back();
+    return m_Original.addresses[m_PC];
+}
+
+
+Debugger::Stop Debugger::Step() noexcept
+{
+    EnterBlocks();
+    if (HasExited())
+        return Stop::Exit;
+
+    std::array<std::uint16_t, static_cast<std::size_t>(CPU::Register::RF) + 1> before;
+    for (std::size_t i = 0; i < before.size(); ++i)
+        before[i] = m_CPU.GetRegister(static_cast<CPU::Register>(i));
+
+    // Always step the original operation, the patched one might be a trap
+    if (m_CPU.Execute(m_Original, m_PC, m_PC + 1) == m_PC)
+    {
+        m_PC = m_Original.ops.size();
+        return Stop::Exit;
+    }
+    ++m_PC;
+    EnterBlocks();
+
+    for (std::size_t i = 0; i < before.size(); ++i)
+    {
+        if (m_Watched[i] && before[i] != m_CPU.GetRegister(static_cast<CPU::Register>(i)))
+            return Stop::Watchpoint;
+    }
+    return HasExited() ? Stop::Exit : Stop::Step;
+}
+
+
+Debugger::Stop Debugger::Continue() noexcept
+{
+    if (IsWatching())
+    {
+        Stop stop = Step();
+        while (stop == Stop::Step)
+        {
+            if (m_Patched.ops[m_PC].instruction == CPU::Instruction::TRAP)
+                return Stop::Breakpoint;
+            stop = Step();
+        }
+        return stop;
+    }
+
+    // Move off the breakpoint we are currently sitting on
+    EnterBlocks();
+    if (!HasExited() && m_Patched.ops[m_PC].instruction == CPU::Instruction::TRAP)
+    {
+        const Stop stop = Step();
+        if (stop != Stop::Step)
+            return stop;
+    }
+
+    m_PC = m_CPU.Execute(m_Patched, m_PC, m_Patched.ops.size());
+    if (!HasExited() && m_Patched.ops[m_PC].instruction == CPU::Instruction::TRAP)
+        return Stop::Breakpoint;
+
+    m_PC = m_Original.ops.size();
+    return Stop::Exit;
+}
+
+
+void Debugger::PrintRegisters(std::ostream& out) const
+{
+    out << "Reg   u16    i16\n";
+    for (std::size_t i = 0; i <= CPU::Register::RF; ++i)
+    {
+        const std::uint16_t value = m_CPU.GetRegister(static_cast<CPU::Register>(i));
+        out << CPU::GetRegisterName(static_cast<CPU::Register>(i)) << ": " << std::setw(5) << value << ' ' << std::setw(6) << static_cast<std::int16_t>(value) << '\n';
+    }
+    out << "Cycles: " << m_CPU.GetCycles() << '\n';
+}
+
+
+void Debugger::RunCli(std::istream& in, std::ostream& out)
+{
+    static constexpr std::array<std::string_view, static_cast<std::size_t>(Stop::Exit) + 1> StopNames = {
+        "Step", "Breakpoint", "Watchpoint", "Exited"
+    };
+
+    out << "Commands: b/d <addr> set/delete breakpoint, w/u <reg> watch/unwatch register, s step, c continue, r registers, q quit\n";
+    std::string line;
+    while (out << "(tiny16) " << std::flush && std::getline(in, line))
+    {
+        std::istringstream stream(line);
+        std::string command;
+        std::string argument;
+        stream >> command >> argument;
+
+        if (command == "b" || command == "d")
+        {
+            const std::optional<std::size_t> address = ParseAddress(argument);
+            if (!address.has_value())
+                out << "Invalid address: '" << argument << "'\n";
+            else if (!(command == "b" ? SetBreakpoint(*address) : ClearBreakpoint(*address)))
+                out << "No " << (command == "b" ? "instruction" : "breakpoint") << " at 0x" << std::hex << *address << std::dec << '\n';
+        }
+        else if (command == "w" || command == "u")
+        {
+            const std::optional<CPU::Register> reg = CPU::ParseRegister(argument);
+            if (!reg.has_value())
+                out << "Invalid register: '" << argument << "'\n";
+            else if (command == "w")
+                Watch(*reg);
+            else
+                Unwatch(*reg);
+        }
+        else if (command == "s" || command == "c")
+        {
+            const Stop stop = command == "s" ? Step() : Continue();
+            out << StopNames[static_cast<std::size_t>(stop)] << " at 0x" << std::hex << GetAddress() << std::dec << '\n';
+        }
+        else if (command == "r")
+            PrintRegisters(out);
+        else if (command == "q")
+            return;
+        else if (!command.empty())
+            out << "Unknown command: '" << command << "'\n";
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef DEBUGGER_HPP
+#define DEBUGGER_HPP
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <istream>
+#include <ostream>
+
+#include "CPU.hpp"
+#include "Decoder.hpp"
+
+// Breakpoints replace the operation in a private copy of the program with Instruction::TRAP,
+// so continuing without breakpoints runs the unmodified execute loop at full speed.
+// Watchpoints have to single step and are only paid for while one is set.
+class Debugger
+{
+public:
+    enum class Stop
+    {
+        Step,
+        Breakpoint,
+        Watchpoint,
+        Exit
+    };
+private:
+    CPU& m_CPU;
+    const Program& m_Original;
+    Program m_Patched;
+    std::size_t m_PC = 0; // index of the next operation
+    std::array<bool, static_cast<std::size_t>(CPU::Register::RF) + 1> m_Watched = { false };
+private:
+    std::size_t FindOperation(std::size_t address) const noexcept;
+    void EnterBlocks() noexcept;
+    bool IsWatching() const noexcept;
+public:
+    Debugger(CPU& cpu, const Program& program);
+
+    bool SetBreakpoint(std::size_t address) noexcept;
+    bool ClearBreakpoint(std::size_t address) noexcept;
+    inline void Watch(CPU::Register reg) noexcept { m_Watched[reg] = true; }
+    inline void Unwatch(CPU::Register reg) noexcept { m_Watched[reg] = false; }
+
+    Stop Step() noexcept;
+    Stop Continue() noexcept;
+
+    inline bool HasExited() const noexcept { return m_PC >= m_Original.ops.size(); }
+    std::size_t GetAddress() const noexcept;
+
+    void PrintRegisters(std::ostream& out) const;
+    void RunCli(std::istream& in, std::ostream& out);
+};
+
+#endif // DEBUGGER_HPP
@@ -0,0 +1,188 @@
+#include <span>
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+
+#include "CPU.hpp"
+#include "Log.hpp"
+#include "Cycles.hpp"
+#include "Result.hpp"
+#include "Decoder.hpp"
+#include "Metrics.hpp"
+#include "Utility.hpp"
+
+
+std::string_view Mnemonic(CPU::Instruction instruction) noexcept
+{
+    switch (instruction)
+    {
+    case CPU::Instruction::MOVI:  return "MOVI";
+    case CPU::Instruction::MOVR:  return "MOVR";
+    case CPU::Instruction::ADDI:  return "ADDI";
+    case CPU::Instruction::ADDR:  return "ADDR";
+    case CPU::Instruction::SUBI:  return "SUBI";
+    case CPU::Instruction::SUBR:  return "SUBR";
+    case CPU::Instruction::MULI:  return "MULI";
+    case CPU::Instruction::MULR:  return "MULR";
+    case CPU::Instruction::IMULI: return "IMULI";
+    case CPU::Instruction::IMULR: return "IMULR";
+    case CPU::Instruction::DIVI:  return "DIVI";
+    case CPU::Instruction::DIVR:  return "DIVR";
+    case CPU::Instruction::IDIVI: return "IDIVI";
+    case CPU::Instruction::IDIVR: return "IDIVR";
+    case CPU::Instruction::EXIT:  return "EXIT";
+    case CPU::Instruction::BLOCK: return "BLOCK";
+    case CPU::Instruction::TRAP:  return "TRAP";
+    default: return "UNKNOWN";
+    }
+}
+
+
+static Result<Program> DecodeProgram(std::span<const std::uint8_t> code, std::size_t entry, const Cycles::Table& costs)
+{
+    if (entry > code.size())
+    {
+        LOG("Entry point {} is outside of the code ({} bytes)", entry, code.size());
+        return Err();
+    }
+
+    Program program;
+    std::size_t block = 0;
+    std::size_t blockSize = 0;
+    std::uint32_t blockCycles = 0;
+    std::size_t address = entry;
+
+    const auto openBlock = [&]()
+    {
+        block = program.ops.size();
+        blockSize = 0;
+        blockCycles = 0;
+        program.ops.push_back({ .instruction = CPU::Instruction::BLOCK });
+        program.addresses.push_back(address);
+    };
+    const auto closeBlock = [&]()
+    {
+        program.ops[block].imm = static_cast<std::uint16_t>(blockCycles);
+    };
+
+    openBlock();
+    for (std::size_t i = entry; i < code.size();)
+    {
+        address = i;
+        if (blockSize == Program::MaxBlockSize)
+        {
+            closeBlock();
+            openBlock();
+        }
+
+        Operation op = { .instruction = static_cast<CPU::Instruction>(code[i]) };
+        switch (op.instruction)
+        {
+        case CPU::Instruction::MOVI:
+        case CPU::Instruction::ADDI:
+        case CPU::Instruction::SUBI:
+        case CPU::Instruction::MULI:
+        case CPU::Instruction::IMULI:
+        case CPU::Instruction::DIVI:
+        case CPU::Instruction::IDIVI: // op (16bit) reg
+        {
+            if (i + 4 > code.size())
+            {
+                LOG("{}: Instruction not complete, expected {} bytes, received {} bytes, code index {}", Mnemonic(op.instruction), 4, code.size() - i, i);
+                return Err();
+            }
+
+            op.imm = Util::Bytes::LoadLittleEndian16(&code[i + 1]);
+            op.dest = code[i + 3];
+            if (op.dest >= CPU::Register::RF)
+            {
+                LOG("{}: Illegal register used: 0x{:X}", Mnemonic(op.instruction), static_cast<std::size_t>(op.dest));
+                return Err();
+            }
+            i += 4;
+            break;
+        }
+        case CPU::Instruction::MOVR:
+        case CPU::Instruction::ADDR:
+        case CPU::Instruction::SUBR:
+        case CPU::Instruction::MULR:
+        case CPU::Instruction::IMULR:
+        case CPU::Instruction::DIVR:
+        case CPU::Instruction::IDIVR: // op reg reg
+        {
+            if (i + 3 > code.size())
+            {
+                LOG("{}: Instruction not complete, expected {} bytes, received {} bytes, code index {}", Mnemonic(op.instruction), 3, code.size() - i, i);
+                return Err();
+            }
+
+            op.src = code[i + 1];
+            op.dest = code[i + 2];
+            if (op.src >= CPU::Register::RF)
+            {
+                LOG("{}: Source register doesn't exist: 0x{:X}", Mnemonic(op.instruction), static_cast<std::size_t>(op.src));
+                return Err();
+            }
+            if (op.dest >= CPU::Register::RF)
+            {
+                LOG("{}: Destination register doesn't exist: 0x{:X}", Mnemonic(op.instruction), static_cast<std::size_t>(op.dest));
+                return Err();
+            }
+            i += 3;
+            break;
+        }
+        case CPU::Instruction::EXIT:
+        {
+            // There are no jumps yet, nothing after the first exit can be reached
+            i = code.size();
+            break;
+        }
+        default:
+            LOG("Unsupported instruction used: 0x{:X} ({}), code index {}", static_cast<std::size_t>(code[i]), static_cast<std::size_t>(code[i]), i);
+            return Err();
+        }
+
+        program.ops.push_back(op);
+        program.addresses.push_back(address);
+        blockCycles += costs[static_cast<std::size_t>(op.instruction)];
+        ++blockSize;
+    }
+    closeBlock();
+    CountInstructions(program);
+    return program;
+}
+
+
+void CountInstructions(Program& program)
+{
+    std::array<std::uint64_t, 256> counts = { 0 };
+    for (const Operation& op : program.ops)
+    {
+        if (op.instruction != CPU::Instruction::BLOCK && op.instruction != CPU::Instruction::TRAP)
+            ++counts[static_cast<std::size_t>(op.instruction)];
+    }
+
+    program.instructionCounts.clear();
+    for (std::size_t opcode = 0; opcode < counts.size(); ++opcode)
+    {
+        if (counts[opcode] != 0)
+            program.instructionCounts.emplace_back(static_cast<CPU::Instruction>(opcode), counts[opcode]);
+    }
+}
+
+
+Result<Program> Decode(std::span<const std::uint8_t> code, std::size_t entry, const Cycles::Table& costs)
+{
+    Result<Program> program = DecodeProgram(code, entry, costs);
+    if (program.IsErr())
+        Metrics::Add(&Metrics::Counters::guestsFaulted, 1);
+    return program;
+}
+
+
+Result<Program> Decode(const std::vector<std::uint8_t>& code, std::size_t entry, const Cycles::Table& costs)
+{
+    return Decode(std::span<const std::uint8_t>(code), entry, costs);
+}
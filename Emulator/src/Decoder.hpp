@@ -0,0 +1,44 @@
+#ifndef DECODER_HPP
+#define DECODER_HPP
+#include <span>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+#include <string_view>
+
+#include "CPU.hpp"
+#include "Cycles.hpp"
+#include "Result.hpp"
+
+// A single instruction with its operands already extracted and validated
+struct Operation
+{
+    CPU::Instruction instruction;
+    std::uint8_t src = 0;
+    std::uint8_t dest = 0; // also the register of immediate instructions
+    std::uint16_t imm = 0;
+};
+
+// Decoded form of a binary, split into basic blocks that each start with an Instruction::BLOCK operation
+struct Program
+{
+    // Block costs are stored in the 16 bit immediate of the BLOCK operation,
+    // 256 instructions with at most 255 cycles each always fit
+    static constexpr std::size_t MaxBlockSize = 256;
+
+    std::vector<Operation> ops;
+    std::vector<std::size_t> addresses; // code index of every operation, BLOCK shares it with the next instruction
+
+    // Guest instructions by opcode, set by CountInstructions when the program is built.
+    // Metrics record a complete run from it without walking ops, an optimized program keeps
+    // the counts of the program it was made from.
+    std::vector<std::pair<CPU::Instruction, std::uint64_t>> instructionCounts;
+};
+
+Result<Program> Decode(std::span<const std::uint8_t> code, std::size_t entry = 0, const Cycles::Table& costs = Cycles::Default());
+Result<Program> Decode(const std::vector<std::uint8_t>& code, std::size_t entry = 0, const Cycles::Table& costs = Cycles::Default());
+std::string_view Mnemonic(CPU::Instruction instruction) noexcept;
+void CountInstructions(Program& program);
+
+#endif // DECODER_HPP
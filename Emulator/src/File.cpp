@@ -1,15 +1,45 @@
+#include <span>
+#include <array>
+#include <mutex>
+#include <cerrno>
+#include <limits>
+#include <string>
+#include <thread>
 #include <vector>
+#include <atomic>
 #include <cstdint>
+#include <cstddef>
 #include <fstream>
 #include <iterator>
+#include <utility>
 #include <iostream>
+#include <algorithm>
+#include <functional>
 #include <string_view>
+#include <condition_variable>
 
 #include "Log.hpp"
 #include "File.hpp"
+#include "Arena.hpp"
+#include "Image.hpp"
+#include "Metrics.hpp"
 #include "Result.hpp"
 
-Result<std::vector<std::uint8_t>> LoadFile(std::string_view path)
+#ifdef PLATFORM_UNIX
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/stat.h>
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+#endif
+
+#if defined PLATFORM_UNIX && __has_include(<linux/io_uring.h>)
+    #define IO_URING_AVAILABLE
+    #include <linux/io_uring.h>
+#endif
+
+// Regular files are read with a single read, only streams without a size are read in chunks
+static Result<void> ReadFile(std::string_view path, std::vector<std::uint8_t>& bytes)
 {
     std::ifstream file(path.data(), std::ios::in | std::ios::binary);
 
@@ -19,5 +49,574 @@ Result<std::vector<std::uint8_t>> LoadFile(std::string_view path)
         return Err();
     }
 
-    return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
-}
\ No newline at end of file
+    const std::streamoff size = file.seekg(0, std::ios::end) ? static_cast<std::streamoff>(file.tellg()) : -1;
+    bool complete = true;
+    if (size >= 0 && file.seekg(0))
+    {
+        bytes.resize(static_cast<std::size_t>(size));
+        complete = file.read(reinterpret_cast<char*>(bytes.data()), static_cast<std::streamsize>(size)).gcount() == size;
+    }
+    else
+    {
+        file.clear();
+        std::array<char, 64 * 1024> chunk;
+        while (file.read(chunk.data(), chunk.size()) || file.gcount() > 0)
+            bytes.insert(bytes.end(), chunk.begin(), chunk.begin() + file.gcount());
+    }
+
+    if (file.bad() || !complete)
+    {
+        LOG_REASON("Failed to read file: '{}'", path);
+        return Err();
+    }
+    Metrics::Add(&Metrics::Counters::loadedBytes, bytes.size());
+    return Ok();
+}
+
+
+Result<std::vector<std::uint8_t>> LoadFile(std::string_view path)
+{
+    std::vector<std::uint8_t> bytes;
+    if (ReadFile(path, bytes).IsErr())
+        return Err();
+    return bytes;
+}
+
+
+Result<Image> LoadImage(std::string_view path)
+{
+    #ifdef PLATFORM_UNIX
+        // Containers are parsed straight from a mapping of the file, the sections are copied out of it once.
+        // Anything that can't be mapped (empty files, pipes) is read instead.
+        const int fd = open(std::string(path).c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat info = {};
+        if (fd >= 0 && fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+        {
+            const std::size_t size = static_cast<std::size_t>(info.st_size);
+            void* const mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+            close(fd);
+            if (mapping != MAP_FAILED)
+            {
+                Metrics::Add(&Metrics::Counters::loadedBytes, size);
+                Result<Image> image = ParseImage(std::span<const std::uint8_t>(static_cast<const std::uint8_t*>(mapping), size));
+                munmap(mapping, size);
+                return image;
+            }
+        }
+        else if (fd >= 0)
+            close(fd);
+    #endif
+
+    std::vector<std::uint8_t> bytes;
+    if (ReadFile(path, bytes).IsErr())
+        return Err();
+    return ParseImage(std::move(bytes));
+}
+
+
+Result<void> SaveFile(std::string_view path, const std::vector<std::uint8_t>& bytes)
+{
+    std::ofstream file(path.data(), std::ios::out | std::ios::binary | std::ios::trunc);
+
+    if (!file.is_open())
+    {
+        LOG_REASON("Failed to open file: '{}'", path);
+        return Err();
+    }
+
+    file.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    if (!file)
+    {
+        LOG_REASON("Failed to write file: '{}'", path);
+        return Err();
+    }
+    return Ok();
+}
+
+
+// State of a single file while loading, error holds an errno value
+struct PendingFile
+{
+    int fd = -1;
+    int error = 0;
+    std::size_t size = 0;
+    std::size_t done = 0;
+    std::uint8_t* buffer = nullptr;
+};
+
+
+#ifdef IO_URING_AVAILABLE
+// Minimal io_uring on top of the raw system calls, the queues are only used from one thread
+class IoRing
+{
+private:
+    int m_Fd = -1;
+    io_uring_params m_Params = {};
+    void* m_SqRing = MAP_FAILED;
+    void* m_CqRing = MAP_FAILED;
+    std::size_t m_SqRingSize = 0;
+    std::size_t m_CqRingSize = 0;
+    io_uring_sqe* m_Sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    std::uint32_t m_Queued = 0;
+
+    template <typename T>
+    inline T* SqField(std::uint32_t offset) const noexcept { return reinterpret_cast<T*>(static_cast<std::uint8_t*>(m_SqRing) + offset); }
+    template <typename T>
+    inline T* CqField(std::uint32_t offset) const noexcept { return reinterpret_cast<T*>(static_cast<std::uint8_t*>(m_CqRing) + offset); }
+
+    bool Supports(const std::vector<std::uint8_t>& opcodes) const noexcept
+    {
+        static constexpr std::size_t ProbeOps = 256;
+        alignas(io_uring_probe) std::array<std::uint8_t, sizeof(io_uring_probe) + ProbeOps * sizeof(io_uring_probe_op)> storage = {};
+        io_uring_probe* const probe = reinterpret_cast<io_uring_probe*>(storage.data());
+        if (syscall(SYS_io_uring_register, m_Fd, IORING_REGISTER_PROBE, probe, ProbeOps) < 0)
+            return false;
+
+        for (const std::uint8_t opcode : opcodes)
+        {
+            if (opcode > probe->last_op || (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED) == 0)
+                return false;
+        }
+        return true;
+    }
+public:
+    explicit IoRing(std::uint32_t entries) noexcept
+    {
+        m_Fd = static_cast<int>(syscall(SYS_io_uring_setup, entries, &m_Params));
+        if (m_Fd < 0)
+            return; // not built into the kernel or forbidden by seccomp
+
+        m_SqRingSize = m_Params.sq_off.array + m_Params.sq_entries * sizeof(std::uint32_t);
+        m_CqRingSize = m_Params.cq_off.cqes + m_Params.cq_entries * sizeof(io_uring_cqe);
+        if (m_Params.features & IORING_FEAT_SINGLE_MMAP)
+            m_SqRingSize = m_CqRingSize = std::max(m_SqRingSize, m_CqRingSize);
+
+        m_SqRing = mmap(nullptr, m_SqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_Fd, IORING_OFF_SQ_RING);
+        if (m_SqRing == MAP_FAILED)
+            return;
+        if (m_Params.features & IORING_FEAT_SINGLE_MMAP)
+            m_CqRing = m_SqRing;
+        else if ((m_CqRing = mmap(nullptr, m_CqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_Fd, IORING_OFF_CQ_RING)) == MAP_FAILED)
+            return;
+        m_Sqes = static_cast<io_uring_sqe*>(mmap(nullptr, m_Params.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_Fd, IORING_OFF_SQES));
+    }
+
+    ~IoRing()
+    {
+        if (m_Sqes != MAP_FAILED)
+            munmap(m_Sqes, m_Params.sq_entries * sizeof(io_uring_sqe));
+        if (m_CqRing != MAP_FAILED && m_CqRing != m_SqRing)
+            munmap(m_CqRing, m_CqRingSize);
+        if (m_SqRing != MAP_FAILED)
+            munmap(m_SqRing, m_SqRingSize);
+        if (m_Fd >= 0)
+            close(m_Fd);
+    }
+
+    IoRing(const IoRing&) = delete;
+    IoRing& operator=(const IoRing&) = delete;
+
+    // Usable if all rings are mapped and the kernel knows every opcode we need (5.6+)
+    bool IsValid() const noexcept
+    {
+        return m_Sqes != MAP_FAILED && m_CqRing != MAP_FAILED && Supports({ IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_CLOSE });
+    }
+
+    inline std::uint32_t Capacity() const noexcept { return m_Params.sq_entries; }
+
+    // At most Capacity() entries can be queued before SubmitAndWait
+    io_uring_sqe& Queue(std::uint8_t opcode, std::uint64_t userData) noexcept
+    {
+        std::uint32_t& tail = *SqField<std::uint32_t>(m_Params.sq_off.tail);
+        const std::uint32_t index = (tail + m_Queued) & *SqField<std::uint32_t>(m_Params.sq_off.ring_mask);
+        SqField<std::uint32_t>(m_Params.sq_off.array)[index] = index;
+        ++m_Queued;
+
+        io_uring_sqe& sqe = m_Sqes[index];
+        sqe = {};
+        sqe.opcode = opcode;
+        sqe.user_data = userData;
+        return sqe;
+    }
+
+    // Submits everything queued and calls onComplete(userData, result) for every completion. Returns false
+    // if the kernel refused entries, those are dropped but the ones it took are still awaited since they point at buffers of the caller.
+    template <typename F>
+    bool SubmitAndWait(F&& onComplete) noexcept
+    {
+        std::atomic_ref<std::uint32_t> sqTail(*SqField<std::uint32_t>(m_Params.sq_off.tail));
+        sqTail.fetch_add(m_Queued, std::memory_order_release);
+        std::uint32_t submit = m_Queued;
+        std::uint32_t pending = m_Queued;
+        m_Queued = 0;
+        bool failed = false;
+
+        std::atomic_ref<std::uint32_t> head(*CqField<std::uint32_t>(m_Params.cq_off.head));
+        const std::atomic_ref<std::uint32_t> tail(*CqField<std::uint32_t>(m_Params.cq_off.tail));
+        const std::uint32_t mask = *CqField<std::uint32_t>(m_Params.cq_off.ring_mask);
+        const io_uring_cqe* const cqes = CqField<io_uring_cqe>(m_Params.cq_off.cqes);
+        while (pending > 0)
+        {
+            const long submitted = syscall(SYS_io_uring_enter, m_Fd, submit, pending, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (submitted >= 0)
+                submit -= static_cast<std::uint32_t>(submitted);
+            else if (errno != EINTR && submit > 0)
+            {
+                // Without SQPOLL the kernel only takes entries inside io_uring_enter, the rest can be taken back
+                sqTail.fetch_sub(submit, std::memory_order_release);
+                pending -= submit;
+                submit = 0;
+                failed = true;
+            }
+
+            std::uint32_t current = head.load(std::memory_order_relaxed);
+            for (const std::uint32_t end = tail.load(std::memory_order_acquire); current != end; ++current, --pending)
+                onComplete(cqes[current & mask].user_data, cqes[current & mask].res);
+            head.store(current, std::memory_order_release);
+        }
+        return !failed;
+    }
+};
+
+
+static bool OpenWithRing(IoRing& ring, std::span<const std::string> paths, std::vector<PendingFile>& files)
+{
+    // every file takes an open and a statx entry
+    std::vector<struct statx> stats(paths.size());
+    const auto onComplete = [&files, &stats](std::uint64_t userData, std::int32_t result)
+    {
+        PendingFile& file = files[userData >> 1];
+        if (result < 0)
+            file.error = file.error == 0 ? -result : file.error;
+        else if ((userData & 1) == 0)
+            file.fd = result;
+        else
+            file.size = static_cast<std::size_t>(stats[userData >> 1].stx_size);
+    };
+
+    const std::size_t batch = ring.Capacity() / 2;
+    for (std::size_t begin = 0; begin < paths.size(); begin += batch)
+    {
+        for (std::size_t i = begin; i < std::min(begin + batch, paths.size()); ++i)
+        {
+            io_uring_sqe& open = ring.Queue(IORING_OP_OPENAT, i << 1);
+            open.fd = AT_FDCWD;
+            open.addr = reinterpret_cast<std::uint64_t>(paths[i].c_str());
+            open.open_flags = O_RDONLY | O_CLOEXEC;
+
+            io_uring_sqe& stat = ring.Queue(IORING_OP_STATX, i << 1 | 1);
+            stat.fd = AT_FDCWD;
+            stat.addr = reinterpret_cast<std::uint64_t>(paths[i].c_str());
+            stat.len = STATX_SIZE;
+            stat.off = reinterpret_cast<std::uint64_t>(&stats[i]);
+        }
+        if (!ring.SubmitAndWait(onComplete))
+            return false;
+    }
+    return true;
+}
+
+
+static bool CloseWithRing(IoRing& ring, std::vector<PendingFile>& files)
+{
+    // A failed close still releases the descriptor
+    const auto onComplete = [&files](std::uint64_t userData, std::int32_t) { files[userData].fd = -1; };
+
+    std::uint32_t queued = 0;
+    for (std::size_t i = 0; i < files.size(); ++i)
+    {
+        if (files[i].fd < 0)
+            continue;
+        ring.Queue(IORING_OP_CLOSE, i).fd = files[i].fd;
+        if (++queued == ring.Capacity())
+        {
+            if (!ring.SubmitAndWait(onComplete))
+                return false;
+            queued = 0;
+        }
+    }
+    return queued == 0 || ring.SubmitAndWait(onComplete);
+}
+
+
+static bool ReadWithRing(IoRing& ring, std::vector<PendingFile>& files)
+{
+    const auto onComplete = [&files](std::uint64_t userData, std::int32_t result)
+    {
+        PendingFile& file = files[userData];
+        if (result == -EINTR || result == -EAGAIN)
+            return; // queued again in the next round
+        if (result < 0)
+            file.error = -result;
+        else if (result == 0)
+            file.size = file.done; // the file shrank since statx
+        else
+            file.done += static_cast<std::size_t>(result);
+    };
+
+    // Short reads are continued in the next round
+    for (bool pending = true; pending;)
+    {
+        pending = false;
+        std::uint32_t queued = 0;
+        for (std::size_t i = 0; i < files.size(); ++i)
+        {
+            PendingFile& file = files[i];
+            if (file.fd < 0 || file.error != 0 || file.done == file.size)
+                continue;
+
+            pending = true;
+            io_uring_sqe& read = ring.Queue(IORING_OP_READ, i);
+            read.fd = file.fd;
+            read.addr = reinterpret_cast<std::uint64_t>(file.buffer + file.done);
+            read.len = static_cast<std::uint32_t>(std::min<std::size_t>(file.size - file.done, std::numeric_limits<std::int32_t>::max()));
+            read.off = file.done;
+            if (++queued == ring.Capacity())
+            {
+                if (!ring.SubmitAndWait(onComplete))
+                    return false;
+                queued = 0;
+            }
+        }
+        if (queued > 0 && !ring.SubmitAndWait(onComplete))
+            return false;
+    }
+
+    // The data is complete, descriptors the ring couldn't close are closed directly
+    if (!CloseWithRing(ring, files))
+    {
+        for (PendingFile& file : files)
+        {
+            if (file.fd >= 0)
+                close(file.fd);
+            file.fd = -1;
+        }
+    }
+    return true;
+}
+#endif
+
+
+#ifdef PLATFORM_UNIX
+// Threads that stay alive for all phases of a Load, the calling thread works along
+class ThreadPool
+{
+private:
+    std::mutex m_Mutex;
+    std::condition_variable m_Wake;
+    std::condition_variable m_Done;
+    std::function<void(std::size_t)> m_Body;
+    std::size_t m_Count = 0;
+    std::atomic<std::size_t> m_Next = 0;
+    std::size_t m_Busy = 0;
+    std::uint64_t m_Phase = 0;
+    bool m_Stop = false;
+    std::vector<std::jthread> m_Threads; // last, joined before the rest is destroyed
+private:
+    void Drain()
+    {
+        for (std::size_t i = m_Next.fetch_add(1, std::memory_order_relaxed); i < m_Count; i = m_Next.fetch_add(1, std::memory_order_relaxed))
+            m_Body(i);
+    }
+
+    void Work()
+    {
+        std::uint64_t phase = 0;
+        while (true)
+        {
+            {
+                std::unique_lock lock(m_Mutex);
+                m_Wake.wait(lock, [this, phase]() { return m_Stop || m_Phase != phase; });
+                if (m_Stop)
+                    return;
+                phase = m_Phase;
+            }
+            Drain();
+
+            std::lock_guard lock(m_Mutex);
+            if (--m_Busy == 0)
+                m_Done.notify_one();
+        }
+    }
+public:
+    explicit ThreadPool(std::size_t threads)
+    {
+        m_Threads.reserve(threads);
+        for (std::size_t i = 0; i < threads; ++i)
+            m_Threads.emplace_back([this]() { Work(); });
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard lock(m_Mutex);
+            m_Stop = true;
+        }
+        m_Wake.notify_all();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Runs body(index) for every index in [0, count) and returns once all are done
+    void ParallelFor(std::size_t count, std::function<void(std::size_t)> body)
+    {
+        {
+            std::lock_guard lock(m_Mutex);
+            m_Body = std::move(body);
+            m_Count = count;
+            m_Next.store(0, std::memory_order_relaxed);
+            m_Busy = m_Threads.size();
+            ++m_Phase;
+        }
+        m_Wake.notify_all();
+        Drain();
+
+        std::unique_lock lock(m_Mutex);
+        m_Done.wait(lock, [this]() { return m_Busy == 0; });
+    }
+};
+
+
+static void OpenWithThreads(ThreadPool& pool, std::span<const std::string> paths, std::vector<PendingFile>& files)
+{
+    pool.ParallelFor(paths.size(), [&paths, &files](std::size_t i)
+    {
+        PendingFile& file = files[i];
+        struct stat info = {};
+        file.fd = open(paths[i].c_str(), O_RDONLY | O_CLOEXEC);
+        if (file.fd < 0 || fstat(file.fd, &info) != 0)
+            file.error = errno;
+        else
+            file.size = static_cast<std::size_t>(info.st_size);
+    });
+}
+
+
+static void ReadWithThreads(ThreadPool& pool, std::vector<PendingFile>& files)
+{
+    pool.ParallelFor(files.size(), [&files](std::size_t i)
+    {
+        PendingFile& file = files[i];
+        if (file.fd < 0)
+            return;
+
+        while (file.error == 0 && file.done < file.size)
+        {
+            const ssize_t result = pread(file.fd, file.buffer + file.done, file.size - file.done, static_cast<off_t>(file.done));
+            if (result < 0 && errno != EINTR)
+                file.error = errno;
+            else if (result == 0)
+                file.size = file.done; // the file shrank since fstat
+            else if (result > 0)
+                file.done += static_cast<std::size_t>(result);
+        }
+        close(file.fd);
+        file.fd = -1;
+    });
+}
+#endif
+
+
+std::vector<Result<std::span<const std::uint8_t>>> BulkLoader::Load(std::span<const std::string> paths)
+{
+    m_Buffers.Reset();
+    std::vector<PendingFile> files(paths.size());
+    const auto allocateBuffer = [this](PendingFile& file)
+    {
+        if (file.error == 0 && file.size > 0)
+        {
+            file.buffer = m_Buffers.Allocate(file.size);
+            if (file.buffer == nullptr)
+                file.error = ENOMEM;
+        }
+    };
+
+#ifdef PLATFORM_UNIX
+    bool opened = false;
+    bool read = false;
+    #ifdef IO_URING_AVAILABLE
+        IoRing ring(256);
+        if (ring.IsValid())
+        {
+            opened = OpenWithRing(ring, paths, files);
+            if (opened)
+            {
+                std::ranges::for_each(files, allocateBuffer);
+                read = ReadWithRing(ring, files);
+            }
+            else
+            {
+                // some opens may have completed before the ring failed
+                for (PendingFile& file : files)
+                {
+                    if (file.fd >= 0)
+                        close(file.fd);
+                    file = PendingFile();
+                }
+            }
+        }
+    #endif
+
+    if (!read)
+    {
+        // The calling thread is one of the workers
+        const std::size_t threads = std::min<std::size_t>(std::max(std::thread::hardware_concurrency(), 1u), paths.size());
+        ThreadPool pool(threads == 0 ? 0 : threads - 1);
+        if (!opened)
+        {
+            OpenWithThreads(pool, paths, files);
+            std::ranges::for_each(files, allocateBuffer);
+        }
+
+        // reads the ring didn't finish start over, the data is the same
+        for (PendingFile& file : files)
+            file.done = 0;
+        ReadWithThreads(pool, files);
+    }
+#else
+    for (std::size_t i = 0; i < paths.size(); ++i)
+    {
+        // The streams don't have to set errno, the error is given explicitly
+        std::ifstream file(paths[i], std::ios::in | std::ios::binary | std::ios::ate);
+        if (!file.is_open())
+        {
+            files[i].error = ENOENT;
+            continue;
+        }
+        const std::streamoff size = file.tellg();
+        if (size < 0)
+        {
+            files[i].error = EIO;
+            continue;
+        }
+        files[i].size = files[i].done = static_cast<std::size_t>(size);
+        allocateBuffer(files[i]);
+        if (files[i].error != 0 || files[i].size == 0)
+            continue;
+        file.seekg(0);
+        if (!file.read(reinterpret_cast<char*>(files[i].buffer), static_cast<std::streamsize>(files[i].size)))
+            files[i].error = EIO;
+    }
+#endif
+
+    std::vector<Result<std::span<const std::uint8_t>>> results;
+    results.reserve(paths.size());
+    std::uint64_t loaded = 0;
+    for (std::size_t i = 0; i < paths.size(); ++i)
+    {
+        if (files[i].error != 0)
+        {
+            errno = files[i].error;
+            LOG_REASON("Failed to load file: '{}'", paths[i]);
+            results.push_back(Err());
+        }
+        else
+        {
+            results.push_back(std::span<const std::uint8_t>(files[i].buffer, files[i].size));
+            loaded += files[i].size;
+        }
+    }
+    Metrics::Add(&Metrics::Counters::loadedBytes, loaded);
+    return results;
+}
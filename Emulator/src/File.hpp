@@ -1,11 +1,28 @@
 #ifndef FILE_HPP
 #define FILE_HPP
+#include <span>
+#include <string>
 #include <vector>
 #include <cstdint>
 #include <string_view>
 
+#include "Arena.hpp"
+#include "Image.hpp"
 #include "Result.hpp"
 
 Result<std::vector<std::uint8_t>> LoadFile(std::string_view path);
+Result<Image> LoadImage(std::string_view path);
+Result<void> SaveFile(std::string_view path, const std::vector<std::uint8_t>& bytes);
+
+
+// Loads many files at once, through io_uring where the kernel allows it, otherwise with a pool of threads.
+// The returned contents live in the loader's buffers and stay valid until the next Load.
+class BulkLoader
+{
+private:
+    ByteArena m_Buffers;
+public:
+    std::vector<Result<std::span<const std::uint8_t>>> Load(std::span<const std::string> paths);
+};
 
 #endif // FILE_HPP
\ No newline at end of file
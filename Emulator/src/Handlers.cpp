@@ -0,0 +1,188 @@
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+
+#include "CPU.hpp"
+#include "Decoder.hpp"
+#include "Handlers.hpp"
+
+// RF can't be used by instructions, the decoder rejects it
+static constexpr std::size_t RegisterCount = CPU::Register::RF;
+using RegisterSequence = std::make_index_sequence<RegisterCount>;
+
+static constexpr std::array<CPU::Instruction, 7> ImmediateInstructions = {
+    CPU::Instruction::MOVI, CPU::Instruction::ADDI, CPU::Instruction::SUBI, CPU::Instruction::MULI,
+    CPU::Instruction::IMULI, CPU::Instruction::DIVI, CPU::Instruction::IDIVI
+};
+static constexpr std::array<CPU::Instruction, 7> RegisterInstructions = {
+    CPU::Instruction::MOVR, CPU::Instruction::ADDR, CPU::Instruction::SUBR, CPU::Instruction::MULR,
+    CPU::Instruction::IMULR, CPU::Instruction::DIVR, CPU::Instruction::IDIVR
+};
+
+using ImmediateTable = std::array<Handler, RegisterCount>;
+using RegisterTable = std::array<std::array<Handler, RegisterCount>, RegisterCount>;
+
+
+struct Handlers::Impl
+{
+    template <CPU::Instruction I, std::size_t Dest>
+    static bool Immediate(CPU& cpu, const Operation& op) noexcept
+    {
+        cpu.Apply<I>(Dest, op.imm); // Dest is a constant and folds away after inlining
+        return true;
+    }
+
+
+    template <CPU::Instruction I, std::size_t Src, std::size_t Dest>
+    static bool Register(CPU& cpu, const Operation&) noexcept
+    {
+        cpu.Apply<I>(Dest, cpu.m_Registers[Src]);
+        return true;
+    }
+
+
+    template <CPU::Instruction I>
+    static bool GenericImmediate(CPU& cpu, const Operation& op) noexcept
+    {
+        cpu.Apply<I>(op.dest, op.imm);
+        return true;
+    }
+
+
+    template <CPU::Instruction I>
+    static bool GenericRegister(CPU& cpu, const Operation& op) noexcept
+    {
+        cpu.Apply<I>(op.dest, cpu.m_Registers[op.src]);
+        return true;
+    }
+
+
+    static bool Block(CPU& cpu, const Operation& op) noexcept
+    {
+        // the whole block is charged up front
+        cpu.m_Cycles += op.imm;
+        return true;
+    }
+
+
+    static bool Stop(CPU&, const Operation&) noexcept
+    {
+        return false;
+    }
+};
+
+
+template <CPU::Instruction I, std::size_t... Dest>
+static consteval ImmediateTable MakeImmediateTable(std::index_sequence<Dest...>) noexcept
+{
+    return { &Handlers::Impl::Immediate<I, Dest>... };
+}
+
+
+template <CPU::Instruction I, std::size_t Src, std::size_t... Dest>
+static consteval std::array<Handler, RegisterCount> MakeRegisterRow(std::index_sequence<Dest...>) noexcept
+{
+    return { &Handlers::Impl::Register<I, Src, Dest>... };
+}
+
+
+template <CPU::Instruction I, std::size_t... Src>
+static consteval RegisterTable MakeRegisterTable(std::index_sequence<Src...>) noexcept
+{
+    return { MakeRegisterRow<I, Src>(RegisterSequence{})... };
+}
+
+
+template <std::size_t... K>
+static consteval std::array<ImmediateTable, sizeof...(K)> MakeImmediateTables(std::index_sequence<K...>) noexcept
+{
+    return { MakeImmediateTable<ImmediateInstructions[K]>(RegisterSequence{})... };
+}
+
+
+template <std::size_t... K>
+static consteval std::array<RegisterTable, sizeof...(K)> MakeRegisterTables(std::index_sequence<K...>) noexcept
+{
+    return { MakeRegisterTable<RegisterInstructions[K]>(RegisterSequence{})... };
+}
+
+
+template <std::size_t... K>
+static consteval std::array<Handler, sizeof...(K)> MakeGenericImmediate(std::index_sequence<K...>) noexcept
+{
+    return { &Handlers::Impl::GenericImmediate<ImmediateInstructions[K]>... };
+}
+
+
+template <std::size_t... K>
+static consteval std::array<Handler, sizeof...(K)> MakeGenericRegister(std::index_sequence<K...>) noexcept
+{
+    return { &Handlers::Impl::GenericRegister<RegisterInstructions[K]>... };
+}
+
+
+static constexpr std::array ImmediateTables = MakeImmediateTables(std::make_index_sequence<ImmediateInstructions.size()>{});
+static constexpr std::array RegisterTables = MakeRegisterTables(std::make_index_sequence<RegisterInstructions.size()>{});
+static constexpr std::array GenericImmediateTable = MakeGenericImmediate(std::make_index_sequence<ImmediateInstructions.size()>{});
+static constexpr std::array GenericRegisterTable = MakeGenericRegister(std::make_index_sequence<RegisterInstructions.size()>{});
+
+
+static constexpr std::size_t IndexOf(const std::array<CPU::Instruction, 7>& instructions, CPU::Instruction instruction) noexcept
+{
+    for (std::size_t i = 0; i < instructions.size(); ++i)
+    {
+        if (instructions[i] == instruction)
+            return i;
+    }
+    return instructions.size();
+}
+
+
+Handler Handlers::Select(const Operation& op, bool specialized) noexcept
+{
+    switch (op.instruction)
+    {
+    case CPU::Instruction::BLOCK:
+        return &Impl::Block;
+    case CPU::Instruction::EXIT:
+    case CPU::Instruction::TRAP:
+        return &Impl::Stop;
+    default:
+        break;
+    }
+
+    if (op.src >= RegisterCount || op.dest >= RegisterCount)
+        return nullptr;
+
+    if (const std::size_t i = IndexOf(ImmediateInstructions, op.instruction); i != ImmediateInstructions.size())
+        return specialized ? ImmediateTables[i][op.dest] : GenericImmediateTable[i];
+
+    if (const std::size_t i = IndexOf(RegisterInstructions, op.instruction); i != RegisterInstructions.size())
+        return specialized ? RegisterTables[i][op.src][op.dest] : GenericRegisterTable[i];
+    return nullptr;
+}
+
+
+std::vector<Handler> Handlers::Bind(const Program& program, bool specialized)
+{
+    std::vector<Handler> handlers;
+    handlers.reserve(program.ops.size());
+    for (const Operation& op : program.ops)
+        handlers.push_back(Select(op, specialized));
+    return handlers;
+}
+
+
+std::size_t Handlers::Count() noexcept
+{
+    // + Block and Stop
+    return ImmediateInstructions.size() * RegisterCount + RegisterInstructions.size() * RegisterCount * RegisterCount + 2;
+}
+
+
+std::size_t Handlers::TableSize() noexcept
+{
+    return sizeof(ImmediateTables) + sizeof(RegisterTables);
+}
@@ -0,0 +1,27 @@
+#ifndef HANDLERS_HPP
+#define HANDLERS_HPP
+#include <vector>
+#include <cstddef>
+
+#include "Decoder.hpp"
+
+// Every (instruction, src, dest) combination gets its own handler with the registers
+// as template parameters, so executing an operation does no operand decoding at all.
+// Operations don't carry them, CPU::Execute only calls them through a table built by Bind.
+class Handlers
+{
+public:
+    struct Impl; // the handler templates, only defined in Handlers.cpp
+
+    // Returns the handler for op or nullptr if op is invalid.
+    // Generic handlers read the registers from the operation, they are used as a baseline in benchmarks.
+    static Handler Select(const Operation& op, bool specialized = true) noexcept;
+
+    // Returns the handler of every operation in program, indexed like program.ops
+    static std::vector<Handler> Bind(const Program& program, bool specialized = true);
+
+    static std::size_t Count() noexcept;
+    static std::size_t TableSize() noexcept;
+};
+
+#endif // HANDLERS_HPP
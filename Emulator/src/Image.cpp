@@ -0,0 +1,243 @@
+#include <span>
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <utility>
+#include <optional>
+
+#include "CPU.hpp"
+#include "Log.hpp"
+#include "Image.hpp"
+#include "Result.hpp"
+#include "Decoder.hpp"
+#include "Utility.hpp"
+
+enum Flags : std::uint16_t
+{
+    HasProgram = 1 << 0,
+    Known = HasProgram
+};
+
+static constexpr std::size_t ChecksumOffset = 32;
+
+// Instructions a decoded section may hold, indexed by instruction. TRAP only exists while debugging.
+static constexpr auto ValidInstructions = []()
+{
+    std::array<bool, static_cast<std::size_t>(CPU::Instruction::TRAP) + 1> valid = {};
+    for (const CPU::Instruction instruction : { CPU::Instruction::MOVI, CPU::Instruction::MOVR, CPU::Instruction::ADDI, CPU::Instruction::ADDR,
+            CPU::Instruction::SUBI, CPU::Instruction::SUBR, CPU::Instruction::MULI, CPU::Instruction::MULR, CPU::Instruction::IMULI,
+            CPU::Instruction::IMULR, CPU::Instruction::DIVI, CPU::Instruction::DIVR, CPU::Instruction::IDIVI, CPU::Instruction::IDIVR,
+            CPU::Instruction::EXIT, CPU::Instruction::BLOCK })
+        valid[static_cast<std::size_t>(instruction)] = true;
+    return valid;
+}();
+
+
+static std::uint64_t AlignUp(std::uint64_t value, std::uint64_t alignment) noexcept
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+
+// The header takes part with its checksum field zeroed, the rest of the file is hashed with it as seed
+static std::uint64_t Checksum(std::span<const std::uint8_t> bytes) noexcept
+{
+    std::array<std::uint8_t, Image::HeaderSize> header;
+    std::memcpy(header.data(), bytes.data(), header.size());
+    std::memset(header.data() + ChecksumOffset, 0, sizeof(std::uint64_t));
+    const std::uint64_t seed = Util::Hash::XXH64(header.data(), header.size());
+    return Util::Hash::XXH64(bytes.data() + Image::HeaderSize, bytes.size() - Image::HeaderSize, seed);
+}
+
+
+bool IsContainer(std::span<const std::uint8_t> bytes) noexcept
+{
+    // 'T' is no valid opcode, so a raw binary can never be mistaken for a container
+    return bytes.size() >= sizeof(Image::Magic) && std::memcmp(bytes.data(), Image::Magic, sizeof(Image::Magic)) == 0;
+}
+
+
+Result<Image> ParseImage(std::vector<std::uint8_t>&& bytes)
+{
+    if (IsContainer(bytes))
+        return ParseImage(std::span<const std::uint8_t>(bytes));
+
+    Image image;
+    image.code = std::move(bytes);
+    return image;
+}
+
+
+Result<Image> ParseImage(std::span<const std::uint8_t> bytes)
+{
+    Image image;
+    if (!IsContainer(bytes))
+    {
+        image.code.assign(bytes.begin(), bytes.end());
+        return image;
+    }
+
+    if (bytes.size() < Image::HeaderSize)
+    {
+        LOG("Container header is truncated, expected {} bytes, received {} bytes", Image::HeaderSize, bytes.size());
+        return Err();
+    }
+
+    const std::uint8_t* header = bytes.data();
+    const std::uint16_t version = Util::Bytes::LoadLittleEndian<std::uint16_t>(header + 4);
+    const std::uint16_t flags = Util::Bytes::LoadLittleEndian<std::uint16_t>(header + 6);
+    const std::uint32_t codeSize32 = Util::Bytes::LoadLittleEndian<std::uint32_t>(header + 12);
+    const std::uint32_t dataSize32 = Util::Bytes::LoadLittleEndian<std::uint32_t>(header + 16);
+    const std::uint32_t opCount32 = Util::Bytes::LoadLittleEndian<std::uint32_t>(header + 20);
+    const std::uint32_t countEntries32 = Util::Bytes::LoadLittleEndian<std::uint32_t>(header + 24);
+    const std::uint32_t reserved = Util::Bytes::LoadLittleEndian<std::uint32_t>(header + 28);
+    const std::uint64_t checksum = Util::Bytes::LoadLittleEndian<std::uint64_t>(header + ChecksumOffset);
+    image.entry = Util::Bytes::LoadLittleEndian<std::uint32_t>(header + 8);
+
+    if (version != Image::Version)
+    {
+        LOG("Unsupported container version {}, expected {}", version, Image::Version);
+        return Err();
+    }
+
+    if ((flags & ~Flags::Known) != 0 || reserved != 0)
+    {
+        LOG("Unknown container flags 0x{:X} or reserved field 0x{:X}", flags & ~Flags::Known, reserved);
+        return Err();
+    }
+
+    const bool hasProgram = (flags & Flags::HasProgram) != 0;
+    if (!hasProgram && (opCount32 != 0 || countEntries32 != 0))
+    {
+        LOG("Container without decoded section has {} operations and {} instruction counts", opCount32, countEntries32);
+        return Err();
+    }
+
+    // The fields are untrusted, computed in 64 bit 32 bit sizes can't overflow even where size_t is 32 bit
+    const std::uint64_t sectionsEnd = static_cast<std::uint64_t>(Image::HeaderSize) + codeSize32 + dataSize32;
+    const std::uint64_t programOffset64 = AlignUp(sectionsEnd, Image::OperationSize);
+    const std::uint64_t programSize = static_cast<std::uint64_t>(opCount32) * Image::OperationSize + static_cast<std::uint64_t>(countEntries32) * Image::CountSize;
+    const std::uint64_t expectedSize = hasProgram ? programOffset64 + programSize : sectionsEnd;
+    if (static_cast<std::uint64_t>(bytes.size()) != expectedSize)
+    {
+        LOG("Container size mismatch, expected {} bytes, received {} bytes", expectedSize, bytes.size());
+        return Err();
+    }
+
+    // All of them fit into size_t now, they are bounded by the size of the file
+    const std::size_t codeSize = codeSize32;
+    const std::size_t dataSize = dataSize32;
+    const std::size_t opCount = opCount32;
+    const std::size_t countEntries = countEntries32;
+    const std::size_t programOffset = static_cast<std::size_t>(programOffset64);
+
+    if (Checksum(bytes) != checksum)
+    {
+        LOG("Container checksum mismatch, expected 0x{:X}", checksum);
+        return Err();
+    }
+
+    if (image.entry > codeSize)
+    {
+        LOG("Entry point {} is outside of the code ({} bytes)", image.entry, codeSize);
+        return Err();
+    }
+
+    const std::uint8_t* const code = bytes.data() + Image::HeaderSize;
+    image.code.assign(code, code + codeSize);
+    image.data.assign(code + codeSize, code + codeSize + dataSize);
+
+    if (hasProgram)
+    {
+        Program program;
+        program.ops.resize(opCount);
+        program.addresses.resize(opCount);
+
+        // The checksum vouches for the section, it is trusted to be what Decode produced for the code.
+        // Only what could reach outside of the registers is checked, in the same pass that copies it.
+        // Addresses aren't stored, every instruction advances them by its size, BLOCK shares the next one.
+        const std::uint8_t* ops = bytes.data() + programOffset;
+        std::size_t address = image.entry;
+        bool invalid = false;
+        for (std::size_t i = 0; i < opCount; ++i, ops += Image::OperationSize)
+        {
+            Operation& op = program.ops[i];
+            const std::uint16_t instruction = Util::Bytes::LoadLittleEndian<std::uint16_t>(ops);
+            op.instruction = static_cast<CPU::Instruction>(instruction);
+            op.src = ops[2];
+            op.dest = ops[3];
+            op.imm = Util::Bytes::LoadLittleEndian<std::uint16_t>(ops + 4);
+            program.addresses[i] = address;
+            address += instruction >= static_cast<std::uint16_t>(CPU::Instruction::BLOCK) ? 0 : instruction == static_cast<std::uint16_t>(CPU::Instruction::EXIT) ? 1 : instruction % 2 == 0 ? 4 : 3;
+            invalid |= instruction >= ValidInstructions.size() || !ValidInstructions[instruction] || op.src >= CPU::Register::RF || op.dest >= CPU::Register::RF;
+        }
+        if (invalid)
+        {
+            LOG("Invalid operation in decoded section ({} operations)", opCount);
+            return Err();
+        }
+
+        // Counts are sorted by opcode and only hold guest instructions, metrics index by them
+        const std::uint8_t* counts = ops;
+        program.instructionCounts.reserve(countEntries);
+        for (std::size_t i = 0; i < countEntries; ++i, counts += Image::CountSize)
+        {
+            const std::uint32_t opcode = Util::Bytes::LoadLittleEndian<std::uint32_t>(counts);
+            const std::uint64_t count = Util::Bytes::LoadLittleEndian<std::uint64_t>(counts + 4);
+            const bool sorted = program.instructionCounts.empty() || static_cast<std::uint32_t>(program.instructionCounts.back().first) < opcode;
+            if (opcode >= ValidInstructions.size() || !ValidInstructions[opcode] || opcode == static_cast<std::uint32_t>(CPU::Instruction::BLOCK) || !sorted)
+            {
+                LOG("Invalid instruction count for 0x{:X}, entry {}", opcode, i);
+                return Err();
+            }
+            program.instructionCounts.emplace_back(static_cast<CPU::Instruction>(opcode), count);
+        }
+        image.program = std::move(program);
+    }
+    return image;
+}
+
+
+std::vector<std::uint8_t> SerializeImage(const Image& image)
+{
+    std::vector<std::uint8_t> out(Image::Magic, Image::Magic + sizeof(Image::Magic));
+    const std::size_t opCount = image.program.has_value() ? image.program->ops.size() : 0;
+
+    Util::Bytes::StoreLittleEndian<std::uint16_t>(out, Image::Version);
+    Util::Bytes::StoreLittleEndian<std::uint16_t>(out, image.program.has_value() ? Flags::HasProgram : 0);
+    Util::Bytes::StoreLittleEndian(out, static_cast<std::uint32_t>(image.entry));
+    Util::Bytes::StoreLittleEndian(out, static_cast<std::uint32_t>(image.code.size()));
+    Util::Bytes::StoreLittleEndian(out, static_cast<std::uint32_t>(image.data.size()));
+    Util::Bytes::StoreLittleEndian(out, static_cast<std::uint32_t>(opCount));
+    Util::Bytes::StoreLittleEndian(out, static_cast<std::uint32_t>(image.program.has_value() ? image.program->instructionCounts.size() : 0));
+    Util::Bytes::StoreLittleEndian<std::uint32_t>(out, 0); // reserved
+    Util::Bytes::StoreLittleEndian<std::uint64_t>(out, 0); // checksum, filled in below
+
+    out.insert(out.end(), image.code.begin(), image.code.end());
+    out.insert(out.end(), image.data.begin(), image.data.end());
+
+    if (image.program.has_value())
+    {
+        out.resize(static_cast<std::size_t>(AlignUp(out.size(), Image::OperationSize)), 0);
+        for (const Operation& op : image.program->ops)
+        {
+            Util::Bytes::StoreLittleEndian(out, static_cast<std::uint16_t>(op.instruction));
+            out.push_back(op.src);
+            out.push_back(op.dest);
+            Util::Bytes::StoreLittleEndian(out, op.imm);
+            Util::Bytes::StoreLittleEndian<std::uint16_t>(out, 0);
+        }
+        for (const auto& [instruction, count] : image.program->instructionCounts)
+        {
+            Util::Bytes::StoreLittleEndian(out, static_cast<std::uint32_t>(instruction));
+            Util::Bytes::StoreLittleEndian(out, count);
+        }
+    }
+
+    const std::uint64_t checksum = Checksum(out);
+    for (std::size_t i = 0; i < sizeof(checksum); ++i)
+        out[ChecksumOffset + i] = static_cast<std::uint8_t>(checksum >> (8 * i));
+    return out;
+}
@@ -0,0 +1,34 @@
+#ifndef IMAGE_HPP
+#define IMAGE_HPP
+#include <span>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <optional>
+
+#include "Result.hpp"
+#include "Decoder.hpp"
+
+// Container format for Tiny16 binaries, see SPEC.txt "=== CONTAINER ===".
+// Files without the magic number are raw binaries and are loaded as code starting at index 0.
+struct Image
+{
+    static constexpr std::uint8_t Magic[4] = { 'T', 'Y', '1', '6' };
+    static constexpr std::uint16_t Version = 2;
+    static constexpr std::size_t HeaderSize = 40;
+    static constexpr std::size_t OperationSize = 8; // instruction (u16), src (u8), dest (u8), imm (u16), padding (u16)
+    static constexpr std::size_t CountSize = 12;    // opcode (u32), count (u64)
+
+    std::size_t entry = 0;
+    std::vector<std::uint8_t> code;
+    std::vector<std::uint8_t> data;
+    std::optional<Program> program; // pre-decoded section, trusted once the checksum matches
+};
+
+// Raw binaries can be decoded straight from the bytes, containers have to be parsed
+bool IsContainer(std::span<const std::uint8_t> bytes) noexcept;
+Result<Image> ParseImage(std::span<const std::uint8_t> bytes);
+Result<Image> ParseImage(std::vector<std::uint8_t>&& bytes);
+std::vector<std::uint8_t> SerializeImage(const Image& image);
+
+#endif // IMAGE_HPP
@@ -0,0 +1,86 @@
+#include <thread>
+#include <vector>
+#include <system_error>
+#include <cstdint>
+#include <cstddef>
+
+#include "CPU.hpp"
+#include "Log.hpp"
+#include "Arena.hpp"
+#include "Result.hpp"
+#include "Decoder.hpp"
+#include "Machine.hpp"
+
+Machine::Machine(std::size_t cores) noexcept : m_CoreCount(cores)
+{
+}
+
+
+Machine::~Machine()
+{
+    for (CPU* cpu : m_Cores)
+        m_Arena.Release(cpu);
+}
+
+
+Result<void> Machine::AcquireCores()
+{
+    if (m_Arena.Reserve(m_CoreCount).IsErr())
+        return Err();
+
+    m_Cores.reserve(m_CoreCount);
+    for (std::size_t i = 0; i < m_CoreCount; ++i)
+    {
+        CPU* const cpu = m_Arena.Acquire();
+        if (cpu == nullptr)
+        {
+            LOG("Failed to create core {} of {}", i, m_CoreCount);
+            for (CPU* acquired : m_Cores)
+                m_Arena.Release(acquired);
+            m_Cores.clear();
+            return Err();
+        }
+        m_Cores.push_back(cpu);
+    }
+    return Ok();
+}
+
+
+Result<void> Machine::Execute(const Program& program, Mode mode)
+{
+    if (m_Cores.empty() && AcquireCores().IsErr())
+        return Err();
+
+    // A single core starts like the plain CPU does, with every register zeroed
+    if (m_Cores.size() > 1)
+    {
+        for (std::size_t i = 0; i < m_Cores.size(); ++i)
+        {
+            m_Cores[i]->SetRegister(CPU::Register::R0, static_cast<std::uint16_t>(i));
+            m_Cores[i]->SetRegister(CPU::Register::R1, static_cast<std::uint16_t>(m_Cores.size()));
+        }
+    }
+
+    if (mode == Mode::Deterministic)
+    {
+        for (CPU* cpu : m_Cores)
+            cpu->Execute(program);
+        return Ok();
+    }
+
+    // The program is never written during execution, so all threads can share it without synchronization
+    std::vector<std::jthread> threads;
+    threads.reserve(m_Cores.size());
+    try
+    {
+        for (CPU* cpu : m_Cores)
+            threads.emplace_back([cpu, &program]() noexcept { cpu->Execute(program); });
+    }
+    catch (const std::system_error& error)
+    {
+        // The threads already started are joined when threads goes out of scope
+        LOG("Failed to start thread {} of {}: {}", threads.size() + 1, m_Cores.size(), error.what());
+        return Err();
+    }
+    return Ok();
+}
@@ -0,0 +1,47 @@
+#ifndef MACHINE_HPP
+#define MACHINE_HPP
+#include <vector>
+#include <cstddef>
+
+#include "CPU.hpp"
+#include "Arena.hpp"
+#include "Result.hpp"
+#include "Decoder.hpp"
+
+// Runs several CPU cores over one shared, read-only decoded program.
+// With more than one core, every core starts with its index in R0 and the core count in R1 so guest
+// code can split its work. A single core starts with zeroed registers like a plain CPU.
+class Machine
+{
+public:
+    // Core index and count are handed to the guest in 16 bit registers
+    static constexpr std::size_t MaxCores = 0xFFFF;
+
+    enum class Mode
+    {
+        Threaded,     // every core runs on its own host thread
+        Deterministic // cores run one after another on the calling thread, useful for debugging
+    };
+private:
+    // Cores are written from different threads, the arena keeps every one on its own cache line.
+    // All cores are acquired by the calling thread and share its NUMA node, they are small
+    // enough to stay in the cache of the core running them.
+    std::size_t m_CoreCount;
+    InstanceArena<CPU> m_Arena;
+    std::vector<CPU*> m_Cores;
+private:
+    Result<void> AcquireCores();
+public:
+    explicit Machine(std::size_t cores) noexcept;
+    ~Machine();
+    Machine(const Machine&) = delete;
+    Machine& operator=(const Machine&) = delete;
+
+    // The cores are created on the first call and keep their state between calls
+    Result<void> Execute(const Program& program, Mode mode);
+
+    inline std::size_t CoreCount() const noexcept { return m_Cores.size(); }
+    inline const CPU& GetCore(std::size_t index) const noexcept { return *m_Cores[index]; }
+};
+
+#endif // MACHINE_HPP
@@ -0,0 +1,280 @@
+#include <array>
+#include <cerrno>
+#include <atomic>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <ostream>
+#include <algorithm>
+#include <string_view>
+
+#include "CPU.hpp"
+#include "Log.hpp"
+#include "Result.hpp"
+#include "Decoder.hpp"
+#include "Metrics.hpp"
+
+#ifdef PLATFORM_UNIX
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+// Threads beyond this share the last slot and update it with atomic adds
+static constexpr std::uint32_t MaxSlots = 256;
+static constexpr std::array<char, 8> Magic = { 'T', 'Y', '1', '6', 'M', 'E', 'T', 'R' };
+static constexpr std::uint32_t Version = 1;
+
+struct Segment
+{
+    struct alignas(64) Header
+    {
+        std::array<char, 8> magic;
+        std::uint32_t version;
+        std::uint32_t slotCount;
+        std::atomic<std::uint32_t> usedSlots;
+    } header;
+    std::array<Metrics::Counters, MaxSlots> slots;
+};
+
+static std::atomic<Segment*> Published = nullptr;
+
+static constexpr std::array<CPU::Instruction, 15> GuestOpcodes = {
+    CPU::Instruction::MOVI, CPU::Instruction::MOVR, CPU::Instruction::ADDI, CPU::Instruction::ADDR,
+    CPU::Instruction::SUBI, CPU::Instruction::SUBR, CPU::Instruction::MULI, CPU::Instruction::MULR,
+    CPU::Instruction::IMULI, CPU::Instruction::IMULR, CPU::Instruction::DIVI, CPU::Instruction::DIVR,
+    CPU::Instruction::IDIVI, CPU::Instruction::IDIVR, CPU::Instruction::EXIT
+};
+
+// Opcode to histogram bucket, 0 for everything that isn't a guest instruction
+static constexpr std::array<std::uint8_t, 256> Buckets = []()
+{
+    std::array<std::uint8_t, 256> buckets = { 0 };
+    for (std::size_t i = 0; i < GuestOpcodes.size(); ++i)
+        buckets[static_cast<std::size_t>(GuestOpcodes[i])] = static_cast<std::uint8_t>(i + 1);
+    return buckets;
+}();
+
+
+static std::string SegmentName(std::string_view name)
+{
+    return "/tiny16-" + std::string(name);
+}
+
+
+#ifdef PLATFORM_UNIX
+Result<void> Metrics::Publish(std::string_view name)
+{
+    const std::string path = SegmentName(name);
+
+    // Resizing a segment that is still mapped elsewhere would fault its readers (SIGBUS),
+    // a fresh one zeroes the counters of a previous run without touching the old mappings
+    if (shm_unlink(path.c_str()) != 0 && errno != ENOENT)
+    {
+        LOG_REASON("Failed to remove the previous metrics segment '{}'", path);
+        return Err();
+    }
+    const int fd = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0)
+    {
+        LOG_REASON("Failed to create the metrics segment '{}'", path);
+        return Err();
+    }
+
+    if (ftruncate(fd, sizeof(Segment)) != 0)
+    {
+        LOG_REASON("Failed to size the metrics segment '{}'", path);
+        close(fd);
+        return Err();
+    }
+
+    void* const memory = mmap(nullptr, sizeof(Segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED)
+    {
+        LOG_REASON("Failed to map the metrics segment '{}'", path);
+        return Err();
+    }
+
+    // The mapping stays for the lifetime of the process, threads may still record during shutdown
+    Segment* const segment = static_cast<Segment*>(memory);
+    segment->header.version = Version;
+    segment->header.slotCount = MaxSlots;
+    segment->header.magic = Magic;
+    Published.store(segment, std::memory_order_release);
+    return Ok();
+}
+
+
+Result<void> Metrics::WritePrometheus(std::string_view name, std::ostream& out)
+{
+    const std::string path = SegmentName(name);
+    const int fd = shm_open(path.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+    {
+        LOG_REASON("Failed to open the metrics segment '{}'", path);
+        return Err();
+    }
+
+    struct stat info = {};
+    void* const memory = fstat(fd, &info) == 0 && static_cast<std::size_t>(info.st_size) == sizeof(Segment) ? mmap(nullptr, sizeof(Segment), PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (memory == MAP_FAILED)
+    {
+        LOG("Metrics segment '{}' has an unexpected size or can't be mapped", path);
+        return Err();
+    }
+
+    const Segment& segment = *static_cast<const Segment*>(memory);
+    if (segment.header.magic != Magic || segment.header.version != Version || segment.header.slotCount != MaxSlots)
+    {
+        LOG("Metrics segment '{}' has an unsupported format", path);
+        munmap(memory, sizeof(Segment));
+        return Err();
+    }
+
+    const std::size_t used = std::min(segment.header.usedSlots.load(std::memory_order_acquire), MaxSlots);
+    const auto sum = [&segment, used](const auto& counter)
+    {
+        std::uint64_t total = 0;
+        for (std::size_t i = 0; i < used; ++i)
+            total += counter(segment.slots[i]).load(std::memory_order_relaxed);
+        return total;
+    };
+    const auto write = [&out, &sum](std::string_view metric, std::string_view help, std::atomic<std::uint64_t> Counters::* counter)
+    {
+        out << "# HELP " << metric << ' ' << help << "\n# TYPE " << metric << " counter\n";
+        out << metric << ' ' << sum([counter](const Counters& slot) -> const std::atomic<std::uint64_t>& { return slot.*counter; }) << '\n';
+    };
+
+    write("tiny16_instructions_retired_total", "Guest instructions executed.", &Counters::instructions);
+    write("tiny16_guests_started_total", "Guest programs started.", &Counters::guestsStarted);
+    write("tiny16_guests_exited_total", "Guest programs that executed EXIT.", &Counters::guestsExited);
+    write("tiny16_guests_faulted_total", "Guest programs rejected by the decoder.", &Counters::guestsFaulted);
+    write("tiny16_loaded_bytes_total", "Bytes read from program files.", &Counters::loadedBytes);
+    write("tiny16_decode_cache_hits_total", "Programs that didn't have to be decoded.", &Counters::decodeCacheHits);
+    write("tiny16_decode_cache_misses_total", "Decode cache lookups that missed.", &Counters::decodeCacheMisses);
+
+    out << "# HELP tiny16_opcode_retired_total Guest instructions executed by opcode.\n# TYPE tiny16_opcode_retired_total counter\n";
+    for (std::size_t opcode = 0; opcode < std::tuple_size_v<decltype(Counters::opcodes)>; ++opcode)
+    {
+        const std::uint64_t count = sum([opcode](const Counters& slot) -> const std::atomic<std::uint64_t>& { return slot.opcodes[opcode]; });
+        if (count != 0)
+            out << "tiny16_opcode_retired_total{opcode=\"" << Mnemonic(static_cast<CPU::Instruction>(opcode)) << "\"} " << count << '\n';
+    }
+
+    munmap(memory, sizeof(Segment));
+    return Ok();
+}
+#else
+Result<void> Metrics::Publish(std::string_view name)
+{
+    LOG("Metrics are only supported on Unix, can't publish '{}'", name);
+    return Err();
+}
+
+
+Result<void> Metrics::WritePrometheus(std::string_view name, std::ostream&)
+{
+    LOG("Metrics are only supported on Unix, can't read '{}'", name);
+    return Err();
+}
+#endif
+
+
+// Number of Suspend objects alive on this thread
+static thread_local std::size_t Suspended = 0;
+
+
+Metrics::Suspend::Suspend() noexcept
+{
+    ++Suspended;
+}
+
+
+Metrics::Suspend::~Suspend()
+{
+    --Suspended;
+}
+
+
+Metrics::Slot Metrics::Local() noexcept
+{
+    thread_local Slot slot;
+    if (Suspended != 0)
+        return Slot();
+    [[likely]] if (slot.counters != nullptr)
+        return slot;
+
+    Segment* const segment = Published.load(std::memory_order_acquire);
+    if (segment == nullptr)
+        return slot;
+    const std::uint32_t index = segment->header.usedSlots.fetch_add(1, std::memory_order_acq_rel);
+    slot.shared = index >= MaxSlots - 1;
+    slot.counters = &segment->slots[std::min(index, MaxSlots - 1)];
+    return slot;
+}
+
+
+// Tallies the operations [begin, last) into a small local histogram first, four of them so
+// consecutive equal opcodes don't wait on each other. BLOCK and TRAP (0x100, 0x101) land in the unused bucket 0.
+static std::uint64_t RecordOperations(Metrics::Counters& counters, bool shared, const Program& program, std::size_t begin, std::size_t last) noexcept
+{
+    std::array<std::array<std::uint32_t, GuestOpcodes.size() + 1>, 4> tally = {};
+    std::size_t i = begin;
+    for (; i + 4 <= last; i += 4)
+    {
+        ++tally[0][Buckets[static_cast<std::size_t>(program.ops[i + 0].instruction) & 0xFF]];
+        ++tally[1][Buckets[static_cast<std::size_t>(program.ops[i + 1].instruction) & 0xFF]];
+        ++tally[2][Buckets[static_cast<std::size_t>(program.ops[i + 2].instruction) & 0xFF]];
+        ++tally[3][Buckets[static_cast<std::size_t>(program.ops[i + 3].instruction) & 0xFF]];
+    }
+    for (; i < last; ++i)
+        ++tally[0][Buckets[static_cast<std::size_t>(program.ops[i].instruction) & 0xFF]];
+
+    std::uint64_t retired = 0;
+    for (std::size_t bucket = 1; bucket < tally[0].size(); ++bucket)
+    {
+        const std::uint64_t count = static_cast<std::uint64_t>(tally[0][bucket]) + tally[1][bucket] + tally[2][bucket] + tally[3][bucket];
+        if (count == 0)
+            continue;
+        Metrics::Add(counters.opcodes[static_cast<std::size_t>(GuestOpcodes[bucket - 1])], count, shared);
+        retired += count;
+    }
+    return retired;
+}
+
+
+void Metrics::RecordExecution(const Program& program, std::size_t begin, std::size_t end, std::size_t stop) noexcept
+{
+    const Slot slot = Local();
+    [[likely]] if (slot.counters == nullptr)
+        return;
+    Counters& counters = *slot.counters;
+
+    // Only partial runs (debugger steps, server budgets) have to look at the operations,
+    // a run stopped by a breakpoint TRAP is partial even if it is on the last operation
+    const std::size_t last = stop < end ? stop + 1 : end; // the instruction at stop ran as well
+    const bool exited = stop < end && program.ops[stop].instruction == CPU::Instruction::EXIT;
+    const bool complete = begin == 0 && last == program.ops.size() && (stop == end || exited);
+
+    std::uint64_t retired = 0;
+    if (complete)
+    {
+        for (const auto& [instruction, count] : program.instructionCounts)
+        {
+            Add(counters.opcodes[static_cast<std::size_t>(instruction)], count, slot.shared);
+            retired += count;
+        }
+    }
+    else
+        retired = RecordOperations(counters, slot.shared, program, begin, last);
+
+    Add(counters.instructions, retired, slot.shared);
+    if (begin == 0)
+        Add(counters.guestsStarted, 1, slot.shared);
+    if (exited)
+        Add(counters.guestsExited, 1, slot.shared);
+}
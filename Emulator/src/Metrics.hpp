@@ -0,0 +1,79 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <ostream>
+#include <string_view>
+
+#include "Result.hpp"
+
+struct Program;
+
+// Live counters in a POSIX shared memory segment (/dev/shm/tiny16-<name>), so another process can
+// read them while the emulator runs. Every thread owns a cache line aligned slot and updates it
+// with plain stores, readers sum the slots up without locking. Nothing is recorded until Publish was called.
+namespace Metrics
+{
+    struct alignas(64) Counters
+    {
+        std::atomic<std::uint64_t> instructions;
+        std::atomic<std::uint64_t> guestsStarted;
+        std::atomic<std::uint64_t> guestsExited;
+        std::atomic<std::uint64_t> guestsFaulted;   // rejected by the decoder
+        std::atomic<std::uint64_t> loadedBytes;     // read by LoadFile and BulkLoader
+        std::atomic<std::uint64_t> decodeCacheHits; // on disk Cache and the warm programs of the Server
+        std::atomic<std::uint64_t> decodeCacheMisses;
+        std::array<std::atomic<std::uint64_t>, 256> opcodes; // retired instructions by opcode
+    };
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "Counters are shared between processes");
+
+    // Creates the segment, a previous one with the same name is replaced by a new one, readers that
+    // still map the old one keep their view of it. It outlives the process so the final values can still be read.
+    Result<void> Publish(std::string_view name);
+
+    struct Slot
+    {
+        Counters* counters = nullptr; // nullptr if nothing was published
+        bool shared = false;          // more threads than slots, the last one is shared
+    };
+
+    // Slot of the calling thread, empty while a Suspend exists on it
+    Slot Local() noexcept;
+
+    // Executions that aren't guest programs (optimizer verification, benchmarks) record nothing
+    // on the calling thread while one of these exists
+    class Suspend
+    {
+    public:
+        Suspend() noexcept;
+        ~Suspend();
+        Suspend(const Suspend&) = delete;
+        Suspend& operator=(const Suspend&) = delete;
+    };
+
+    inline void Add(std::atomic<std::uint64_t>& counter, std::uint64_t value, bool shared) noexcept
+    {
+        // Only the owning thread writes an exclusive slot, no read-modify-write needed
+        if (shared)
+            counter.fetch_add(value, std::memory_order_relaxed);
+        else
+            counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    inline void Add(std::atomic<std::uint64_t> Counters::* counter, std::uint64_t value) noexcept
+    {
+        if (const Slot slot = Local(); slot.counters != nullptr)
+            Add(slot.counters->*counter, value, slot.shared);
+    }
+
+    // Called once per CPU::Execute, operations [begin, end) ran and execution stopped at stop.
+    // A run over the whole program is recorded from Program::instructionCounts.
+    void RecordExecution(const Program& program, std::size_t begin, std::size_t end, std::size_t stop) noexcept;
+
+    // Sums up the segment of a (possibly running) emulator in the Prometheus text format
+    Result<void> WritePrometheus(std::string_view name, std::ostream& out);
+}
+
+#endif // METRICS_HPP
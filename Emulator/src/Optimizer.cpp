@@ -0,0 +1,276 @@
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <optional>
+
+#include "CPU.hpp"
+#include "Log.hpp"
+#include "Decoder.hpp"
+#include "Metrics.hpp"
+#include "Handlers.hpp"
+#include "Optimizer.hpp"
+
+static constexpr std::size_t RegisterCount = CPU::Register::RF;
+static constexpr std::uint16_t AllRegisters = (1 << RegisterCount) - 1;
+static constexpr std::uint16_t DivisionResult = (1 << CPU::Register::R0) | (1 << CPU::Register::R1);
+
+using KnownRegisters = std::array<std::optional<std::uint16_t>, RegisterCount>;
+
+struct Effects
+{
+    std::uint16_t reads = 0;
+    std::uint16_t writes = 0;   // always written
+    std::uint16_t mayWrite = 0; // written depending on a value that isn't known
+};
+
+
+static constexpr std::uint16_t Bit(std::size_t reg) noexcept
+{
+    return static_cast<std::uint16_t>(1 << reg);
+}
+
+
+static constexpr bool IsImmediate(CPU::Instruction instruction) noexcept
+{
+    switch (instruction)
+    {
+    case CPU::Instruction::MOVI:
+    case CPU::Instruction::ADDI:
+    case CPU::Instruction::SUBI:
+    case CPU::Instruction::MULI:
+    case CPU::Instruction::IMULI:
+    case CPU::Instruction::DIVI:
+    case CPU::Instruction::IDIVI:
+        return true;
+    default:
+        return false;
+    }
+}
+
+
+static Effects GetEffects(const Operation& op, std::optional<std::uint16_t> divisor) noexcept
+{
+    Effects effects;
+    const bool immediate = IsImmediate(op.instruction);
+    if (!immediate)
+        effects.reads |= Bit(op.src);
+
+    switch (op.instruction)
+    {
+    case CPU::Instruction::MOVI:
+    case CPU::Instruction::MOVR:
+        effects.writes |= Bit(op.dest);
+        break;
+    case CPU::Instruction::DIVI:
+    case CPU::Instruction::DIVR:
+    case CPU::Instruction::IDIVI:
+    case CPU::Instruction::IDIVR:
+    {
+        // R0 and R1 are only written if the divisor isn't 0
+        effects.reads |= Bit(op.dest);
+        if (op.instruction == CPU::Instruction::IDIVI)
+            effects.writes |= Bit(op.dest);
+
+        if (immediate)
+            divisor = op.imm;
+        if (!divisor.has_value())
+            effects.mayWrite |= DivisionResult;
+        else if (*divisor != 0)
+            effects.writes |= DivisionResult;
+        break;
+    }
+    default:
+        effects.reads |= Bit(op.dest);
+        effects.writes |= Bit(op.dest);
+        break;
+    }
+    return effects;
+}
+
+
+// IDIVI doesn't compute the same as IDIVR with a constant, see CPU::Apply
+static std::optional<CPU::Instruction> ImmediateForm(CPU::Instruction instruction) noexcept
+{
+    switch (instruction)
+    {
+    case CPU::Instruction::MOVR:  return CPU::Instruction::MOVI;
+    case CPU::Instruction::ADDR:  return CPU::Instruction::ADDI;
+    case CPU::Instruction::SUBR:  return CPU::Instruction::SUBI;
+    case CPU::Instruction::MULR:  return CPU::Instruction::MULI;
+    case CPU::Instruction::IMULR: return CPU::Instruction::IMULI;
+    case CPU::Instruction::DIVR:  return CPU::Instruction::DIVI;
+    default: return std::nullopt;
+    }
+}
+
+
+// Propagates constants forward, operations with only known inputs are evaluated and dropped.
+// Their results stay pending and are only written with a MOVI once something needs the register.
+static Program FoldConstants(const Program& program)
+{
+    Program folded;
+    KnownRegisters known;
+    std::uint16_t pending = 0;
+
+    const auto emit = [&folded](const Operation& op, std::size_t address)
+    {
+        folded.ops.push_back(op);
+        folded.addresses.push_back(address);
+    };
+    const auto materialize = [&](std::uint16_t registers, std::size_t address)
+    {
+        for (std::size_t reg = 0; reg < RegisterCount; ++reg)
+        {
+            if (registers & pending & Bit(reg))
+                emit({ .instruction = CPU::Instruction::MOVI, .dest = static_cast<std::uint8_t>(reg), .imm = *known[reg] }, address);
+        }
+        pending = static_cast<std::uint16_t>(pending & ~registers);
+    };
+
+    for (std::size_t i = 0; i < program.ops.size(); ++i)
+    {
+        Operation op = program.ops[i];
+        const std::size_t address = program.addresses[i];
+
+        if (op.instruction == CPU::Instruction::BLOCK || op.instruction == CPU::Instruction::EXIT)
+        {
+            materialize(AllRegisters, address);
+            known.fill(std::nullopt);
+            emit(op, address);
+            continue;
+        }
+
+        const std::optional<std::uint16_t> source = IsImmediate(op.instruction) ? std::optional<std::uint16_t>(op.imm) : known[op.src];
+        Effects effects = GetEffects(op, source);
+
+        bool allKnown = true;
+        for (std::size_t reg = 0; reg < RegisterCount; ++reg)
+            allKnown = allKnown && (!(effects.reads & Bit(reg)) || known[reg].has_value());
+
+        if (allKnown)
+        {
+            // Evaluating with the real handler gives the exact 16 bit and signed semantics
+            CPU scratch;
+            for (std::size_t reg = 0; reg < RegisterCount; ++reg)
+                scratch.SetRegister(static_cast<CPU::Register>(reg), known[reg].value_or(0));
+            Handlers::Select(op)(scratch, op);
+
+            for (std::size_t reg = 0; reg < RegisterCount; ++reg)
+            {
+                if (effects.writes & Bit(reg))
+                    known[reg] = scratch.GetRegister(static_cast<CPU::Register>(reg));
+            }
+            pending |= effects.writes;
+            continue;
+        }
+
+        if (const std::optional<CPU::Instruction> form = ImmediateForm(op.instruction); form.has_value() && source.has_value())
+        {
+            op = { .instruction = *form, .dest = op.dest, .imm = *source };
+            effects = GetEffects(op, source);
+        }
+
+        // Everything the operation reads or might leave untouched has to hold its real value,
+        // pending values of registers it overwrites are never observed
+        materialize(effects.reads | effects.mayWrite, address);
+        pending = static_cast<std::uint16_t>(pending & ~effects.writes);
+        for (std::size_t reg = 0; reg < RegisterCount; ++reg)
+        {
+            if ((effects.writes | effects.mayWrite) & Bit(reg))
+                known[reg] = std::nullopt;
+        }
+        emit(op, address);
+    }
+
+    if (!program.ops.empty())
+        materialize(AllRegisters, program.addresses.back());
+    return folded;
+}
+
+
+// Removes operations whose results are overwritten before they are read.
+// Every register is observable at the end of a block.
+static Program EliminateDeadWrites(const Program& program)
+{
+    std::vector<bool> dead(program.ops.size(), false);
+    std::uint16_t live = AllRegisters;
+    for (std::size_t i = program.ops.size(); i-- > 0;)
+    {
+        const Operation& op = program.ops[i];
+        if (op.instruction == CPU::Instruction::BLOCK || op.instruction == CPU::Instruction::EXIT)
+        {
+            live = AllRegisters;
+            continue;
+        }
+
+        const Effects effects = GetEffects(op, std::nullopt);
+        if (((effects.writes | effects.mayWrite) & live) == 0)
+        {
+            dead[i] = true;
+            continue;
+        }
+        live = static_cast<std::uint16_t>((live & ~effects.writes) | effects.reads);
+    }
+
+    Program result;
+    for (std::size_t i = 0; i < program.ops.size(); ++i)
+    {
+        if (!dead[i])
+        {
+            result.ops.push_back(program.ops[i]);
+            result.addresses.push_back(program.addresses[i]);
+        }
+    }
+    return result;
+}
+
+
+Program Optimize(const Program& program)
+{
+    Program optimized = EliminateDeadWrites(FoldConstants(program));
+    optimized.instructionCounts = program.instructionCounts; // metrics count guest instructions, not what was left of them
+    return optimized;
+}
+
+
+bool VerifyOptimization(const Program& original, const Program& optimized)
+{
+    // These runs aren't guest programs
+    const Metrics::Suspend suspend;
+
+    // All zero like a fresh CPU and an arbitrary pattern, the optimizer must not rely on either
+    std::uint16_t seed = 0;
+    for (std::size_t run = 0; run < 2; ++run)
+    {
+        CPU expected;
+        CPU actual;
+        for (std::size_t reg = 0; reg < RegisterCount; ++reg)
+        {
+            expected.SetRegister(static_cast<CPU::Register>(reg), seed);
+            actual.SetRegister(static_cast<CPU::Register>(reg), seed);
+            seed = static_cast<std::uint16_t>(seed * 31421u + 6927u);
+        }
+
+        expected.Execute(original);
+        actual.Execute(optimized);
+
+        for (std::size_t reg = 0; reg <= CPU::Register::RF; ++reg)
+        {
+            const std::uint16_t want = expected.GetRegister(static_cast<CPU::Register>(reg));
+            const std::uint16_t got = actual.GetRegister(static_cast<CPU::Register>(reg));
+            if (want != got)
+            {
+                LOG("Optimizer verification failed: register {} is {}, expected {}", reg, got, want);
+                return false;
+            }
+        }
+
+        if (expected.GetCycles() != actual.GetCycles())
+        {
+            LOG("Optimizer verification failed: {} cycles, expected {}", actual.GetCycles(), expected.GetCycles());
+            return false;
+        }
+    }
+    return true;
+}
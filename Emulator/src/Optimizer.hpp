@@ -0,0 +1,13 @@
+#ifndef OPTIMIZER_HPP
+#define OPTIMIZER_HPP
+#include "Decoder.hpp"
+
+// Folds constants and removes dead writes within basic blocks. No assumptions about the
+// initial register values are made and BLOCK operations are kept, so the optimized program
+// ends with the same register file and is charged the same cycles as the original.
+Program Optimize(const Program& program);
+
+// Runs both programs from the same initial register files and compares the results
+bool VerifyOptimization(const Program& original, const Program& optimized);
+
+#endif // OPTIMIZER_HPP
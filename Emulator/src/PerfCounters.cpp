@@ -0,0 +1,136 @@
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <optional>
+#include <string_view>
+
+#include "PerfCounters.hpp"
+
+#if defined PLATFORM_UNIX && __has_include(<linux/perf_event.h>)
+    #define PERF_COUNTERS_AVAILABLE
+    #include <unistd.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+    #include <linux/perf_event.h>
+#endif
+
+#ifdef PERF_COUNTERS_AVAILABLE
+static int OpenEvent(std::uint32_t type, std::uint64_t config) noexcept
+{
+    perf_event_attr attr = {};
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1; // allowed with perf_event_paranoid <= 2
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    // glibc has no wrapper, measure this thread on any cpu
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+}
+
+
+static constexpr std::uint64_t CacheReadMiss(std::uint64_t cache) noexcept
+{
+    return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+
+PerfCounters::PerfCounters() noexcept
+{
+    m_Fds[Event::Cycles] = OpenEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    m_Fds[Event::Instructions] = OpenEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    m_Fds[Event::BranchMisses] = OpenEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    m_Fds[Event::L1dMisses] = OpenEvent(PERF_TYPE_HW_CACHE, CacheReadMiss(PERF_COUNT_HW_CACHE_L1D));
+    m_Fds[Event::L1iMisses] = OpenEvent(PERF_TYPE_HW_CACHE, CacheReadMiss(PERF_COUNT_HW_CACHE_L1I));
+}
+
+
+PerfCounters::~PerfCounters()
+{
+    for (const int fd : m_Fds)
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+}
+
+
+void PerfCounters::Start() noexcept
+{
+    for (const int fd : m_Fds)
+    {
+        if (fd >= 0)
+        {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+
+void PerfCounters::Stop() noexcept
+{
+    for (const int fd : m_Fds)
+    {
+        if (fd >= 0)
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    }
+}
+
+
+std::optional<std::uint64_t> PerfCounters::Read(Event event) const noexcept
+{
+    // Layout given by read_format in OpenEvent
+    struct
+    {
+        std::uint64_t value;
+        std::uint64_t enabled;
+        std::uint64_t running;
+    } data = {};
+    if (!IsAvailable(event) || read(m_Fds[event], &data, sizeof(data)) != sizeof(data))
+        return std::nullopt;
+
+    // More events than hardware counters are multiplexed, each only counts part of the time.
+    // An event that never got a counter has no value, 0 would look like a perfect result.
+    if (data.running == 0)
+        return std::nullopt;
+    if (data.running == data.enabled)
+        return data.value;
+    return static_cast<std::uint64_t>(static_cast<double>(data.value) * static_cast<double>(data.enabled) / static_cast<double>(data.running));
+}
+#else
+PerfCounters::PerfCounters() noexcept
+{
+    m_Fds.fill(-1);
+}
+
+
+PerfCounters::~PerfCounters() = default;
+
+
+void PerfCounters::Start() noexcept
+{
+}
+
+
+void PerfCounters::Stop() noexcept
+{
+}
+
+
+std::optional<std::uint64_t> PerfCounters::Read(Event) const noexcept
+{
+    return std::nullopt;
+}
+#endif
+
+
+std::string_view PerfCounters::GetName(Event event) noexcept
+{
+    static constexpr std::array<std::string_view, Event::Count> Names = {
+        "host cycles", "host instructions", "branch misses", "L1d misses", "L1i misses"
+    };
+    return Names[event];
+}
@@ -0,0 +1,42 @@
+#ifndef PERF_COUNTERS_HPP
+#define PERF_COUNTERS_HPP
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <optional>
+#include <string_view>
+
+// Host hardware counters via perf_event_open, Linux only.
+// Every event is opened on its own so a missing one (e.g. no L1i events in a VM
+// or perf_event_paranoid) only disables that event, elsewhere nothing is available.
+// Values are scaled up when the kernel multiplexed an event, events that never ran read as nullopt.
+class PerfCounters
+{
+public:
+    enum Event
+    {
+        Cycles,
+        Instructions,
+        BranchMisses,
+        L1dMisses,
+        L1iMisses,
+        Count
+    };
+private:
+    std::array<int, Event::Count> m_Fds;
+public:
+    PerfCounters() noexcept;
+    ~PerfCounters();
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    // Resets and enables / disables all available counters
+    void Start() noexcept;
+    void Stop() noexcept;
+
+    inline bool IsAvailable(Event event) const noexcept { return m_Fds[event] >= 0; }
+    std::optional<std::uint64_t> Read(Event event) const noexcept;
+    static std::string_view GetName(Event event) noexcept;
+};
+
+#endif // PERF_COUNTERS_HPP
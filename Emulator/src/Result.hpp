@@ -126,6 +126,7 @@
 
 #ifndef RESULT_HPP
 #define RESULT_HPP
+#include <new>
 #include <limits>
 #include <cstdio>
 #include <string>
@@ -228,35 +229,46 @@ private:
         E m_Error;
     };
     bool m_Valid;
+
+    void Destroy() noexcept
+    {
+        if (m_Valid)
+            m_Data.~T();
+        else
+            m_Error.~E();
+    }
 public:
     inline Result(const E& e) : m_Error(e), m_Valid(false) {}
     inline Result(const T& t) : m_Data(t), m_Valid(true) {}
+    inline Result(T&& t) : m_Data(std::move(t)), m_Valid(true) {}
 
+    // Only one member of the union is alive, it has to be constructed instead of assigned
     Result(const Result& other) : m_Valid(other.m_Valid)
     {
         if (m_Valid)
-            m_Data = other.m_Data;
+            ::new (&m_Data) T(other.m_Data);
         else
-            m_Error = other.m_Error;
+            ::new (&m_Error) E(other.m_Error);
     }
 
     Result(Result&& other) noexcept : m_Valid(other.m_Valid)
     {
         if (m_Valid)
-            m_Data = std::move(other.m_Data);
+            ::new (&m_Data) T(std::move(other.m_Data));
         else
-            m_Error = std::move(other.m_Error);
+            ::new (&m_Error) E(std::move(other.m_Error));
     }
 
     Result& operator=(const Result& other)
     {
         if (this != &other)
         {
+            Destroy();
             m_Valid = other.m_Valid;
             if (m_Valid)
-                m_Data = other.m_Data;
+                ::new (&m_Data) T(other.m_Data);
             else
-                m_Error = other.m_Error;
+                ::new (&m_Error) E(other.m_Error);
         }
         return *this;
     }
@@ -265,21 +277,19 @@ public:
     {
         if (this != &other)
         {
+            Destroy();
             m_Valid = other.m_Valid;
             if (m_Valid)
-                m_Data = std::move(other.m_Data);
+                ::new (&m_Data) T(std::move(other.m_Data));
             else
-                m_Error = std::move(other.m_Error);
+                ::new (&m_Error) E(std::move(other.m_Error));
         }
         return *this;
     }
 
     ~Result()
     {
-        if (m_Valid)
-            m_Data.~T();
-        else
-            m_Error.~E();
+        Destroy();
     }
 
     inline const T& Ok() const noexcept
@@ -315,11 +325,17 @@ public:
         return !m_Valid;
     }
 
-    inline const T& ForceUnwrap() const
+    inline const T& ForceUnwrap() const&
     {
         return m_Data;
     }
 
+    // Moves the value out of a Result that is about to go away
+    inline T&& ForceUnwrap() &&
+    {
+        return std::move(m_Data);
+    }
+
     inline const T& Unwrap() const
     {
         if (m_Valid)
@@ -0,0 +1,412 @@
+#include <span>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <format>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+#include <charconv>
+#include <algorithm>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+
+#include "CPU.hpp"
+#include "Log.hpp"
+#include "File.hpp"
+#include "Image.hpp"
+#include "Cycles.hpp"
+#include "Result.hpp"
+#include "Server.hpp"
+#include "Decoder.hpp"
+#include "Metrics.hpp"
+#include "Optimizer.hpp"
+
+#ifdef PLATFORM_UNIX
+    #include <poll.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/un.h>
+    #include <sys/socket.h>
+#endif
+
+// Bytes read from a connection before its requests are answered, the rest waits for the next poll
+static constexpr std::size_t MaxBatchSize = 1024 * 1024;
+// Longest request line, a connection sending more without a newline is answered with an error and closed
+static constexpr std::size_t MaxRequestSize = 4 * 1024;
+// Connections with this many unsent bytes aren't read until the client catches up
+static constexpr std::size_t MaxPendingOutput = 1024 * 1024;
+// Out of file descriptors the listener stays readable, it is left out of poll for this long instead of spinning
+static constexpr std::chrono::milliseconds AcceptBackoff(100);
+
+
+struct Server::Entry
+{
+    struct Budget
+    {
+        std::size_t end;     // operation index after the n-th instruction
+        std::uint64_t cycles; // cycles of the first n instructions
+    };
+
+    Program decoded; // budgeted runs stop between any two instructions, so they never use the optimized form
+    std::optional<Program> optimized;
+    std::vector<Budget> budgets; // indexes decoded
+};
+
+
+struct Server::Connection
+{
+    int fd = -1;
+    bool eof = false; // the client won't send more, close once the output is sent
+    std::string input;
+    std::string output;
+    std::size_t sent = 0;
+};
+
+
+template <typename T>
+static std::optional<T> ParseNumber(std::string_view str) noexcept
+{
+    T value = 0;
+    if (str.empty() || std::from_chars(str.data(), str.data() + str.size(), value).ec != std::errc())
+        return std::nullopt;
+    return value;
+}
+
+
+Server::Server(bool optimize) : m_Optimize(optimize)
+{
+}
+
+
+Server::~Server() = default;
+
+
+const Server::Entry* Server::AddProgram(const std::string& path, Program program)
+{
+    std::unique_ptr<Entry> entry = std::make_unique<Entry>();
+    entry->decoded = std::move(program);
+    if (m_Optimize)
+        entry->optimized = Optimize(entry->decoded);
+
+    // Blocks are charged up front, a budget ending inside one only pays for the instructions it ran
+    constexpr Cycles::Table costs = Cycles::Default();
+    std::uint64_t cycles = 0;
+    for (std::size_t i = 0; i < entry->decoded.ops.size(); ++i)
+    {
+        const CPU::Instruction instruction = entry->decoded.ops[i].instruction;
+        if (instruction == CPU::Instruction::BLOCK)
+            continue;
+        cycles += costs[static_cast<std::size_t>(instruction)];
+        entry->budgets.push_back({ i + 1, cycles });
+    }
+    return m_Programs.insert_or_assign(path, std::move(entry)).first->second.get();
+}
+
+
+const Server::Entry* Server::FindProgram(const std::string& path)
+{
+    const auto it = m_Programs.find(path);
+    if (it == m_Programs.end())
+        return nullptr;
+    Metrics::Add(&Metrics::Counters::decodeCacheHits, 1);
+    return it->second.get();
+}
+
+
+Result<void> Server::Preload(std::span<const std::string> paths)
+{
+    if (m_Programs.size() + paths.size() > MaxPrograms)
+    {
+        LOG("Too many programs to serve: {}, at most {}", m_Programs.size() + paths.size(), MaxPrograms);
+        return Err();
+    }
+
+    BulkLoader loader;
+    const std::vector<Result<std::span<const std::uint8_t>>> files = loader.Load(paths);
+    for (std::size_t i = 0; i < paths.size(); ++i)
+    {
+        if (files[i].IsErr())
+            return Err();
+        Metrics::Add(&Metrics::Counters::decodeCacheMisses, 1);
+
+        // Raw binaries are decoded straight from the loader's buffer, only containers become an Image
+        const std::span<const std::uint8_t> bytes = files[i].ForceUnwrap();
+        Result<Program> program = Err();
+        if (!IsContainer(bytes))
+            program = Decode(bytes);
+        else if (Result<Image> image = ParseImage(bytes); image.IsOk())
+        {
+            Image loaded = std::move(image).ForceUnwrap();
+            program = loaded.program.has_value() ? Result<Program>(std::move(*loaded.program)) : Decode(loaded.code, loaded.entry);
+        }
+
+        if (program.IsErr())
+        {
+            LOG("Failed to preload '{}'", paths[i]);
+            return Err();
+        }
+        AddProgram(paths[i], std::move(program).ForceUnwrap());
+    }
+    LOG("Preloaded {} programs", paths.size());
+    return Ok();
+}
+
+
+void Server::HandleRequest(std::string_view request, std::string& response)
+{
+    std::vector<std::string_view> args;
+    while (!request.empty())
+    {
+        const std::size_t begin = request.find_first_not_of(' ');
+        if (begin == std::string_view::npos)
+            break;
+        request.remove_prefix(begin);
+        const std::size_t end = std::min(request.find(' '), request.size());
+        args.push_back(request.substr(0, end));
+        request.remove_prefix(end);
+    }
+
+    if (args.size() < 2 || args[0] != "run")
+    {
+        response += "err expected: run <program> [budget] [reg=value ...]\n";
+        return;
+    }
+
+    const Entry* entry = FindProgram(std::string(args[1]));
+    if (entry == nullptr)
+    {
+        response += std::format("err unknown program '{}'\n", args[1]);
+        return;
+    }
+
+    m_CPU = CPU();
+    std::optional<Entry::Budget> budget;
+    for (std::size_t i = 2; i < args.size(); ++i)
+    {
+        if (const std::size_t eq = args[i].find('='); eq != std::string_view::npos)
+        {
+            const std::optional<CPU::Register> reg = CPU::ParseRegister(args[i].substr(0, eq));
+            const std::optional<std::uint16_t> value = ParseNumber<std::uint16_t>(args[i].substr(eq + 1));
+            if (!reg.has_value() || !value.has_value())
+            {
+                response += std::format("err invalid register assignment '{}'\n", args[i]);
+                return;
+            }
+            m_CPU.SetRegister(*reg, *value);
+        }
+        else if (const std::optional<std::size_t> instructions = ParseNumber<std::size_t>(args[i]); instructions.has_value())
+        {
+            if (*instructions < entry->budgets.size())
+                budget = *instructions == 0 ? Entry::Budget{ 0, 0 } : entry->budgets[*instructions - 1];
+        }
+        else
+        {
+            response += std::format("err invalid argument '{}'\n", args[i]);
+            return;
+        }
+    }
+
+    // A budget is never reached after EXIT, EXIT is the last instruction
+    const Program& program = !budget.has_value() && entry->optimized.has_value() ? *entry->optimized : entry->decoded;
+    const std::size_t end = budget.has_value() ? budget->end : program.ops.size();
+    const std::size_t stop = m_CPU.Execute(program, 0, end);
+    const std::string_view status = stop < end ? "exit" : budget.has_value() ? "budget" : "end";
+
+    response += std::format("ok {}", status);
+    for (std::size_t i = 0; i <= CPU::Register::RF; ++i)
+        response += std::format(" {}", m_CPU.GetRegister(static_cast<CPU::Register>(i)));
+    response += std::format(" {}\n", budget.has_value() ? budget->cycles : m_CPU.GetCycles());
+}
+
+
+#ifdef PLATFORM_UNIX
+bool Server::Receive(Connection& connection)
+{
+    std::array<char, 64 * 1024> buffer;
+    while (!connection.eof && connection.input.size() < MaxBatchSize)
+    {
+        const ssize_t received = recv(connection.fd, buffer.data(), buffer.size(), 0);
+        if (received > 0)
+        {
+            connection.input.append(buffer.data(), static_cast<std::size_t>(received));
+            continue;
+        }
+        if (received == 0)
+        {
+            connection.eof = true; // closed by the client, the requests it sent before are still answered
+            break;
+        }
+        if (errno == EAGAIN) // same as EWOULDBLOCK on Linux
+            break;
+        if (errno != EINTR)
+            return false;
+    }
+
+    // Answer every complete request of the batch before sending anything back
+    std::size_t begin = 0;
+    for (std::size_t end = connection.input.find('\n'); end != std::string::npos; end = connection.input.find('\n', begin))
+    {
+        HandleRequest(std::string_view(connection.input).substr(begin, end - begin), connection.output);
+        begin = end + 1;
+    }
+    connection.input.erase(0, begin);
+
+    if (connection.input.size() > MaxRequestSize)
+    {
+        connection.output += "err request too long\n";
+        connection.input.clear();
+        connection.eof = true;
+    }
+    return Send(connection);
+}
+
+
+bool Server::Send(Connection& connection)
+{
+    while (connection.sent < connection.output.size())
+    {
+        const ssize_t sent = send(connection.fd, connection.output.data() + connection.sent, connection.output.size() - connection.sent, MSG_NOSIGNAL);
+        if (sent < 0)
+            return errno == EAGAIN || errno == EINTR;
+        connection.sent += static_cast<std::size_t>(sent);
+    }
+    connection.output.clear();
+    connection.sent = 0;
+    return true;
+}
+
+
+Result<void> Server::Run(std::string_view socketPath)
+{
+    if (m_Programs.empty())
+    {
+        LOG("No programs to serve on '{}', name them after the socket path", socketPath);
+        return Err();
+    }
+
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path))
+    {
+        LOG("Socket path is too long: '{}'", socketPath);
+        return Err();
+    }
+    socketPath.copy(address.sun_path, socketPath.size());
+
+    const int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listener < 0)
+    {
+        LOG_REASON("Failed to create socket '{}'", socketPath);
+        return Err();
+    }
+
+    unlink(address.sun_path);
+    if (bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0)
+    {
+        LOG_REASON("Failed to listen on '{}'", socketPath);
+        close(listener);
+        return Err();
+    }
+    LOG("Listening on '{}'", socketPath);
+
+    // fds[0] is the listener, fds[i + 1] belongs to connections[i]
+    std::vector<pollfd> fds = { { listener, POLLIN, 0 } };
+    std::vector<Connection> connections;
+    std::optional<std::chrono::steady_clock::time_point> resumeAccept;
+    while (true)
+    {
+        int timeout = -1;
+        if (resumeAccept.has_value())
+        {
+            const auto remaining = std::chrono::ceil<std::chrono::milliseconds>(*resumeAccept - std::chrono::steady_clock::now());
+            if (remaining.count() <= 0)
+            {
+                resumeAccept.reset();
+                fds[0].events = POLLIN;
+            }
+            else
+                timeout = static_cast<int>(remaining.count());
+        }
+
+        if (poll(fds.data(), fds.size(), timeout) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            LOG_REASON("Failed to poll '{}'", socketPath);
+            break;
+        }
+
+        for (std::size_t i = connections.size(); i-- > 0;)
+        {
+            pollfd& pfd = fds[i + 1];
+            Connection& connection = connections[i];
+            bool open = !(pfd.revents & (POLLERR | POLLNVAL));
+            if (open && (pfd.revents & (POLLIN | POLLHUP)))
+                open = Receive(connection);
+            if (open && (pfd.revents & POLLOUT))
+                open = Send(connection);
+            if (connection.eof && connection.output.empty())
+                open = false;
+
+            if (!open)
+            {
+                close(connection.fd);
+                connections.erase(connections.begin() + static_cast<std::ptrdiff_t>(i));
+                fds.erase(fds.begin() + static_cast<std::ptrdiff_t>(i) + 1);
+                continue;
+            }
+            const bool read = !connection.eof && connection.output.size() - connection.sent < MaxPendingOutput;
+            pfd.events = static_cast<short>((read ? POLLIN : 0) | (connection.output.empty() ? 0 : POLLOUT));
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            int client;
+            while ((client = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+            {
+                Connection connection;
+                connection.fd = client;
+                connections.push_back(std::move(connection));
+                fds.push_back({ client, POLLIN, 0 });
+            }
+
+            // Pending clients wait in the backlog until connections are closed or the limit is raised
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+            {
+                LOG_REASON("Failed to accept a connection on '{}', {} open, retrying in {} ms", socketPath, connections.size(), AcceptBackoff.count());
+                fds[0].events = 0;
+                resumeAccept = std::chrono::steady_clock::now() + AcceptBackoff;
+            }
+        }
+    }
+
+    for (const Connection& connection : connections)
+        close(connection.fd);
+    close(listener);
+    unlink(address.sun_path);
+    return Err();
+}
+#else
+bool Server::Receive(Connection&)
+{
+    return false;
+}
+
+
+bool Server::Send(Connection&)
+{
+    return false;
+}
+
+
+Result<void> Server::Run(std::string_view socketPath)
+{
+    LOG("Server mode needs Unix domain sockets, not available on this platform: '{}'", socketPath);
+    return Err();
+}
+#endif
@@ -0,0 +1,43 @@
+#ifndef SERVER_HPP
+#define SERVER_HPP
+#include <span>
+#include <string>
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+
+#include "CPU.hpp"
+#include "Result.hpp"
+
+// Long running server answering run requests over a Unix domain socket, see SPEC.txt "=== SERVER ===".
+// Only programs loaded before serving can be run, so requests never touch the file system and the
+// program table can't grow. Requests are read and answered in batches so clients can pipeline many
+// requests per connection.
+class Server
+{
+public:
+    static constexpr std::size_t MaxPrograms = 4096;
+private:
+    struct Entry;
+    struct Connection;
+
+    bool m_Optimize;
+    CPU m_CPU; // reset for every request instead of being constructed
+    std::unordered_map<std::string, std::unique_ptr<Entry>> m_Programs;
+private:
+    const Entry* AddProgram(const std::string& path, Program program);
+    const Entry* FindProgram(const std::string& path);
+    void HandleRequest(std::string_view request, std::string& response);
+    bool Receive(Connection& connection);
+    bool Send(Connection& connection);
+public:
+    explicit Server(bool optimize);
+    ~Server();
+
+    // Loads all programs in one go before serving, requests name them by exactly the same paths
+    Result<void> Preload(std::span<const std::string> paths);
+    Result<void> Run(std::string_view socketPath);
+};
+
+#endif // SERVER_HPP
@@ -1,7 +1,11 @@
 #ifndef UTILITY_HPP
 #define UTILITY_HPP
 #include <bit>
+#include <vector>
 #include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
 
 namespace Util::Bytes
 {
@@ -15,6 +19,108 @@ namespace Util::Bytes
     {
         return (value >> 8) | (value << 8);
     }
+
+
+    // We emulate a little endian CPU
+    inline std::uint16_t LoadLittleEndian16(const std::uint8_t* ptr) noexcept
+    {
+        std::uint16_t value;
+        std::memcpy(&value, ptr, sizeof(value));
+
+        if constexpr (HostIsBigEndian())
+        {
+            return SwapEndian16(value);
+        }
+        else
+        {
+            return value;
+        }
+    }
+
+
+    // Endian independent loads and stores for file formats
+    template <typename T>
+    constexpr T LoadLittleEndian(const std::uint8_t* ptr) noexcept
+    {
+        // GCC doesn't merge the byte loads below, hashing ran at half the speed
+        if (!std::is_constant_evaluated() && !HostIsBigEndian())
+        {
+            T value;
+            std::memcpy(&value, ptr, sizeof(value));
+            return value;
+        }
+
+        T value = 0;
+        for (std::size_t i = 0; i < sizeof(T); ++i)
+            value |= static_cast<T>(static_cast<T>(ptr[i]) << (8 * i));
+        return value;
+    }
+
+
+    template <typename T>
+    inline void StoreLittleEndian(std::vector<std::uint8_t>& out, T value)
+    {
+        for (std::size_t i = 0; i < sizeof(T); ++i)
+            out.push_back(static_cast<std::uint8_t>(value >> (8 * i)));
+    }
+}
+
+
+namespace Util::Hash
+{
+    // XXH64, see https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+    constexpr std::uint64_t XXH64(const std::uint8_t* data, std::size_t size, std::uint64_t seed = 0) noexcept
+    {
+        constexpr std::uint64_t P1 = 11400714785074694791ULL;
+        constexpr std::uint64_t P2 = 14029467366897019727ULL;
+        constexpr std::uint64_t P3 = 1609587929392839161ULL;
+        constexpr std::uint64_t P4 = 9650029242287828579ULL;
+        constexpr std::uint64_t P5 = 2870177450012600261ULL;
+
+        const auto round = [](std::uint64_t acc, std::uint64_t input) { return std::rotl(acc + input * P2, 31) * P1; };
+        const auto merge = [&round](std::uint64_t acc, std::uint64_t value) { return (acc ^ round(0, value)) * P1 + P4; };
+
+        const std::uint8_t* const end = data + size;
+        std::uint64_t hash = 0;
+        if (size >= 32)
+        {
+            std::uint64_t v1 = seed + P1 + P2;
+            std::uint64_t v2 = seed + P2;
+            std::uint64_t v3 = seed;
+            std::uint64_t v4 = seed - P1;
+            for (; end - data >= 32; data += 32)
+            {
+                v1 = round(v1, Bytes::LoadLittleEndian<std::uint64_t>(data));
+                v2 = round(v2, Bytes::LoadLittleEndian<std::uint64_t>(data + 8));
+                v3 = round(v3, Bytes::LoadLittleEndian<std::uint64_t>(data + 16));
+                v4 = round(v4, Bytes::LoadLittleEndian<std::uint64_t>(data + 24));
+            }
+            hash = std::rotl(v1, 1) + std::rotl(v2, 7) + std::rotl(v3, 12) + std::rotl(v4, 18);
+            hash = merge(merge(merge(merge(hash, v1), v2), v3), v4);
+        }
+        else
+        {
+            hash = seed + P5;
+        }
+        hash += size;
+
+        for (; end - data >= 8; data += 8)
+            hash = std::rotl(hash ^ round(0, Bytes::LoadLittleEndian<std::uint64_t>(data)), 27) * P1 + P4;
+        if (end - data >= 4)
+        {
+            hash = std::rotl(hash ^ (Bytes::LoadLittleEndian<std::uint32_t>(data) * P1), 23) * P2 + P3;
+            data += 4;
+        }
+        for (; data != end; ++data)
+            hash = std::rotl(hash ^ (*data * P5), 11) * P1;
+
+        hash ^= hash >> 33;
+        hash *= P2;
+        hash ^= hash >> 29;
+        hash *= P3;
+        hash ^= hash >> 32;
+        return hash;
+    }
 }
 
 #endif // UTILITY_HPP
\ No newline at end of file
@@ -1,18 +1,169 @@
-#include <cstdint>
+#include <string>
 #include <vector>
+#include <iostream>
+#include <cstdint>
+#include <cstddef>
+#include <charconv>
+#include <optional>
+#include <string_view>
 
 #include "CPU.hpp"
+#include "Log.hpp"
 #include "File.hpp"
+#include "Decoder.hpp"
 #include "Result.hpp"
+#include "Machine.hpp"
+#include "Debugger.hpp"
+#include "Image.hpp"
+#include "Cache.hpp"
+#include "Benchmark.hpp"
+#include "Optimizer.hpp"
+#include "Server.hpp"
+#include "Metrics.hpp"
 
-int main()
+int main(int argc, const char** argv)
 {
-    Result<std::vector<std::uint8_t>> e = LoadFile("examples/example1.ty");
+    std::string_view path = "examples/example1.ty";
+    std::vector<std::string> programPaths; // every program named, the server preloads all of them
+    std::size_t cores = 1;
+    Machine::Mode mode = Machine::Mode::Threaded;
+    bool debug = false;
+    std::string_view packPath;
+    std::string_view cachePath;
+    std::size_t benchIterations = 0;
+    std::size_t cacheBenchIterations = 0;
+    bool optimize = false;
+    bool verify = false;
+    std::string_view socketPath;
+    std::string_view metricsName;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string_view arg = argv[i];
+        if (arg == "--cores" && i + 1 < argc)
+        {
+            const std::string_view value = argv[++i];
+            if (std::from_chars(value.data(), value.data() + value.size(), cores).ec != std::errc() || cores == 0 || cores > Machine::MaxCores)
+            {
+                LOG("Invalid core count: '{}', expected 1 - {}", value, Machine::MaxCores);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (arg == "--deterministic")
+            mode = Machine::Mode::Deterministic;
+        else if (arg == "--debug")
+            debug = true;
+        else if (arg == "--pack" && i + 1 < argc)
+            packPath = argv[++i];
+        else if (arg == "--cache" && i + 1 < argc)
+            cachePath = argv[++i];
+        else if (arg == "--serve" && i + 1 < argc)
+            socketPath = argv[++i];
+        else if (arg == "--metrics" && i + 1 < argc)
+            metricsName = argv[++i];
+        else if (arg == "--metrics-read" && i + 1 < argc)
+            return Metrics::WritePrometheus(argv[++i], std::cout).IsOk() ? 0 : EXIT_FAILURE;
+        else if (arg == "--optimize")
+            optimize = true;
+        else if (arg == "--verify")
+            optimize = verify = true;
+        else if (arg == "--bench" && i + 1 < argc)
+        {
+            const std::string_view value = argv[++i];
+            if (std::from_chars(value.data(), value.data() + value.size(), benchIterations).ec != std::errc() || benchIterations == 0)
+            {
+                LOG("Invalid benchmark iteration count: '{}'", value);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (arg == "--bench-cache" && i + 1 < argc)
+        {
+            const std::string_view value = argv[++i];
+            if (std::from_chars(value.data(), value.data() + value.size(), cacheBenchIterations).ec != std::errc() || cacheBenchIterations == 0)
+            {
+                LOG("Invalid benchmark iteration count: '{}'", value);
+                return EXIT_FAILURE;
+            }
+        }
+        else
+        {
+            path = arg;
+            programPaths.emplace_back(arg);
+        }
+    }
+
+    if (!metricsName.empty() && Metrics::Publish(metricsName).IsErr())
+        return EXIT_FAILURE;
+
+    if (!socketPath.empty())
+    {
+        Server server(optimize);
+        if (!programPaths.empty() && server.Preload(programPaths).IsErr())
+            return EXIT_FAILURE;
+        return server.Run(socketPath).IsOk() ? 0 : EXIT_FAILURE;
+    }
+
+    const Result<Image> e = LoadImage(path);
     if (e.IsErr())
         return EXIT_FAILURE;
 
-    CPU cpu;
-    cpu.Execute(e.ForceUnwrap());
-    CPU_PRINT_REGISTERS(cpu);
+    const Image& image = e.ForceUnwrap();
+    if (cacheBenchIterations != 0)
+    {
+        if (cachePath.empty())
+        {
+            LOG("{} needs a cache directory (--cache <directory>)", "--bench-cache");
+            return EXIT_FAILURE;
+        }
+        return RunCacheBenchmark(image, cachePath, cacheBenchIterations).IsOk() ? 0 : EXIT_FAILURE;
+    }
+
+    const std::optional<Cache> cache = cachePath.empty() ? std::nullopt : std::make_optional<Cache>(cachePath);
+    const std::optional<Program> cached = cache.has_value() && !image.program.has_value() ? cache->Load(image) : std::nullopt;
+    const std::optional<Program>& decoded = image.program.has_value() ? image.program : cached;
+
+    // Containers and cache hits hand out their program directly, only raw binaries are decoded here
+    const Result<Program> fresh = decoded.has_value() ? Result<Program>(Program()) : Decode(image.code, image.entry);
+    if (fresh.IsErr())
+        return EXIT_FAILURE;
+    const Program& program = decoded.has_value() ? *decoded : fresh.ForceUnwrap();
+
+    if (cache.has_value() && !decoded.has_value())
+        cache->Store(image, program);
+
+    const Program optimized = optimize ? Optimize(program) : Program();
+    if (verify && !VerifyOptimization(program, optimized))
+        return EXIT_FAILURE;
+    const Program& executable = optimize ? optimized : program;
+
+    if (!packPath.empty())
+    {
+        Image packed = image;
+        packed.program = program;
+        return SaveFile(packPath, SerializeImage(packed)).IsOk() ? 0 : EXIT_FAILURE;
+    }
+
+    if (benchIterations != 0)
+    {
+        RunBenchmark(executable, benchIterations);
+        return 0;
+    }
+
+    if (debug)
+    {
+        CPU cpu;
+        Debugger debugger(cpu, executable);
+        debugger.RunCli(std::cin, std::cout);
+        return 0;
+    }
+
+    // A single core needs no thread
+    Machine machine(cores);
+    if (machine.Execute(executable, cores == 1 ? Machine::Mode::Deterministic : mode).IsErr())
+        return EXIT_FAILURE;
+    for (std::size_t i = 0; i < machine.CoreCount(); ++i)
+    {
+        CPU_PRINT_REGISTERS(machine.GetCore(i));
+    }
     return 0;
-}
\ No newline at end of file
+}